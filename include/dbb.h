@@ -2,10 +2,34 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#ifndef LIBDBB_DBB_H
+#define LIBDBB_DBB_H
+
 #include <stdio.h>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
 #include <string>
 
+#include "dbb_securemem.h"
+
+class UniValue;
+
 namespace DBB {
+class Transport;
+
+//!replace the transport used for the device connection (default: hidapi)
+// allows running the command stack without a physical device (loopback)
+void setTransport(std::unique_ptr<Transport> transport);
+
+//!record every request and response report to a capture file
+// the capture can be played back with a ReplayTransport
+bool startCapture(const std::string& filename);
+
+//!stop recording the reports
+bool stopCapture();
+
 //!open a connection to the digital bitbox device
 // retruns false if no connection could be made, keeps connection handling
 // internal
@@ -14,19 +38,170 @@ bool openConnection();
 //!close the connection to the dbb device
 bool closeConnection();
 
-//!return true if a USBHID connection is open
+//!return true if a USBHID connection is open and alive
+// the state is cached: set on open, cleared on close, on an I/O error or
+// by deviceDetached(), it does not enumerate the USB bus
 bool isConnectionOpen();
 
+//!enumerate the USB devices and check if the open device is still attached
+// meant for polling on platforms without hotplug events
+bool verifyConnection();
+
+//!report a detached device (hotplug event), marks the connection as closed
+// if the path matches the open device
+void deviceDetached(const std::string& path);
+
+typedef enum DBB_READ_MODE {
+    DBB_READ_MODE_FIXED_REPORT, //!< always read the full HID report (old firmware)
+    DBB_READ_MODE_FRAMED        //!< stop reading once the json response is complete
+} dbb_read_mode_t;
+
+//!set how sendCommand reads responses (default: DBB_READ_MODE_FRAMED)
+// framed mode falls back to a full report read if the response is not json
+void setReadMode(dbb_read_mode_t mode);
+
+//!stream requests and responses larger than one HID report
+// a request is split into consecutive reports and terminated by a NUL byte
+// (an additional empty report if it fills the last one), the response is
+// read over as many reports as needed; requires a firmware supporting it,
+// without it commands larger than one report are rejected (default: off)
+void setChunkedTransfer(bool enabled);
+
 //!send a json command to the device which is currently open
+// throws a runtime_error if the command could not be written/read
 bool sendCommand(const std::string &json, std::string &resultOut);
 
+typedef enum DBB_COMMAND_STATUS {
+    DBB_COMMAND_STATUS_OK,
+    DBB_COMMAND_STATUS_NO_DEVICE,
+    DBB_COMMAND_STATUS_IO_ERROR,
+    DBB_COMMAND_STATUS_TIMEOUT,
+    DBB_COMMAND_STATUS_CANCELED,
+    DBB_COMMAND_STATUS_TOO_LARGE, //!< the command does not fit into a report (or the chunked size limit)
+    DBB_COMMAND_STATUS_ENCRYPTION_FAILED
+} dbb_command_status_t;
+
+//!cancels an asynchronous command, can be shared between threads
+class CancellationToken
+{
+public:
+    CancellationToken() : canceled(false) {}
+    void cancel() { canceled = true; }
+    bool isCanceled() const { return canceled; }
+
+private:
+    std::atomic<bool> canceled;
+};
+typedef std::shared_ptr<CancellationToken> CancellationTokenRef;
+
+class CommandResult
+{
+public:
+    dbb_command_status_t status;
+    std::string response;
+};
+typedef std::function<void(const CommandResult& result)> CommandCallback;
+
+//!runs a task (the completion callback) on another thread/event loop
+typedef std::function<void(const std::function<void()>& task)> Executor;
+
+//!send a json command to the open device, blocks until the response arrived,
+// timeoutMS elapsed (-1 = no timeout) or the token got canceled
+dbb_command_status_t sendCommand(const std::string& json,
+                                 std::string& resultOut,
+                                 int timeoutMS,
+                                 const CancellationTokenRef& token = CancellationTokenRef());
+
+//!send a json command containing secrets (e.g. a password), see above
+dbb_command_status_t sendCommand(const SecureString& json,
+                                 std::string& resultOut,
+                                 int timeoutMS,
+                                 const CancellationTokenRef& token = CancellationTokenRef());
+
+//!send a json command to the open device without blocking the caller
+// commands are executed in order on a single I/O thread, each one is
+// aborted after timeoutMS milliseconds (-1 = no timeout) or when the
+// token gets canceled; the callback runs over the executor (default:
+// directly on the I/O thread)
+std::future<CommandResult> sendCommandAsync(const std::string& json,
+                                            int timeoutMS = -1,
+                                            const CancellationTokenRef& token = CancellationTokenRef(),
+                                            const CommandCallback& callback = CommandCallback(),
+                                            const Executor& executor = Executor());
+
+//!AES key of a session, derived from the device password (double SHA256)
+// the key is derived once, kept in the LockedPool and wiped on destruction,
+// the password itself is not stored
+class SessionKey
+{
+public:
+    explicit SessionKey(const char* password);
+    explicit SessionKey(const std::string& password);
+    explicit SessionKey(const SecureString& password);
+    ~SessionKey();
+
+    //!returns false for an empty password or if no memory could be allocated
+    bool isValid() const;
+
+    //!the AES-256 key (32 bytes)
+    const unsigned char* getKey() const;
+
+private:
+    unsigned char* key;
+
+    void derive(const char* password, size_t len);
+
+    SessionKey(const SessionKey&);
+    SessionKey& operator=(const SessionKey&);
+};
+typedef std::shared_ptr<const SessionKey> SessionKeyRef;
+
 //!decrypt a json result
 bool decryptAndDecodeCommand(const std::string &cmdIn,
-                             const std::string &password,
+                             const SessionKey &key,
                              std::string &stringOut);
 
+//!decrypt a json result into a string living in the LockedPool
+bool decryptAndDecodeCommand(const std::string &cmdIn,
+                             const SessionKey &key,
+                             SecureString &stringOut);
+
+//!decrypt a json result and parse it
+// the ciphertext is decoded and decrypted in place in a per thread scratch
+// buffer which gets wiped afterwards, the plaintext is parsed from there
+bool decryptAndDecodeCommand(const std::string &cmdIn,
+                             const SessionKey &key,
+                             UniValue &valueOut);
+
 //!encrypts a json command
 bool encryptAndEncodeCommand(const std::string &cmd,
-                             const std::string &password,
+                             const SessionKey &key,
                              std::string &base64strOut);
+
+//!returns the length of an encrypted and base64 encoded command of cmdLen bytes
+size_t encryptedCommandSize(size_t cmdLen);
+
+//!pads, encrypts and base64 encodes a command in one pass into out (not NUL terminated)
+// out must have room for encryptedCommandSize(cmdLen) chars, no heap memory is used
+// returns the amount of chars written or 0 in case of an error
+size_t encryptAndEncodeCommand(const char *cmd,
+                               size_t cmdLen,
+                               const SessionKey &key,
+                               char *out,
+                               size_t outLen);
+
+//!encrypt a json command straight into the report buffer of the open device and send it
+// resultOut is the (encrypted) response, use decryptAndDecodeCommand
+dbb_command_status_t sendEncryptedCommand(const std::string &cmd,
+                                          const SessionKey &key,
+                                          std::string &resultOut,
+                                          int timeoutMS = -1,
+                                          const CancellationTokenRef &token = CancellationTokenRef());
+
+dbb_command_status_t sendEncryptedCommand(const SecureString &cmd,
+                                          const SessionKey &key,
+                                          std::string &resultOut,
+                                          int timeoutMS = -1,
+                                          const CancellationTokenRef &token = CancellationTokenRef());
 }
+#endif // LIBDBB_DBB_H
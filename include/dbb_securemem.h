@@ -0,0 +1,67 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LIBDBB_DBB_SECUREMEM_H
+#define LIBDBB_DBB_SECUREMEM_H
+
+#include <stddef.h>
+
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace DBB
+{
+//!allocate memory for secrets (locked against swapping, wiped on release)
+// returns NULL if no memory could be allocated
+void* secureAlloc(size_t size);
+
+//!wipe and release memory returned by secureAlloc()
+void secureFree(void* ptr);
+
+//!allocator taking memory over secureAlloc()
+template <typename T>
+struct secure_allocator : public std::allocator<T> {
+    typedef std::allocator<T> base;
+    typedef typename base::size_type size_type;
+    typedef typename base::difference_type difference_type;
+    typedef typename base::pointer pointer;
+    typedef typename base::const_pointer const_pointer;
+    typedef typename base::reference reference;
+    typedef typename base::const_reference const_reference;
+    typedef typename base::value_type value_type;
+    secure_allocator() throw() {}
+    secure_allocator(const secure_allocator& a) throw() : base(a) {}
+    template <typename U>
+    secure_allocator(const secure_allocator<U>& a) throw() : base(a)
+    {
+    }
+    ~secure_allocator() throw() {}
+    template <typename U>
+    struct rebind {
+        typedef secure_allocator<U> other;
+    };
+
+    T* allocate(std::size_t n, const void* = 0)
+    {
+        T* ptr = static_cast<T*>(secureAlloc(sizeof(T) * n));
+        if (!ptr)
+            throw std::bad_alloc();
+        return ptr;
+    }
+
+    void deallocate(T* p, std::size_t)
+    {
+        secureFree(p);
+    }
+};
+
+//!string and byte buffer living in the LockedPool, wiped on release
+// mind: short strings are stored inside the string object itself (SSO)
+typedef std::basic_string<char, std::char_traits<char>, secure_allocator<char> > SecureString;
+typedef std::vector<unsigned char, secure_allocator<unsigned char> > SecureBytes;
+}
+
+#endif // LIBDBB_DBB_SECUREMEM_H
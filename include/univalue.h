@@ -7,9 +7,11 @@
 #define BITCOIN_UNIVALUE_UNIVALUE_H
 
 #include <stdint.h>
+#include <string.h>
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
 #include <cassert>
 
 #include <sstream>        // .get_int64()
@@ -20,9 +22,12 @@ public:
     enum VType { VNULL, VOBJ, VARR, VSTR, VNUM, VREAL, VBOOL, };
 
     UniValue() { typ = VNULL; }
-    UniValue(UniValue::VType initialType, const std::string& initialStr = "") {
+    UniValue(UniValue::VType initialType, std::string initialStr = "") {
         typ = initialType;
-        val = initialStr;
+        if (typ == VNUM || typ == VREAL)
+            setNumText(initialStr);
+        else
+            val = std::move(initialStr);
     }
     UniValue(uint64_t val_) {
         setInt(val_);
@@ -37,16 +42,22 @@ public:
         setInt(val_);
     }
     UniValue(double val_) {
-        setFloat(val_);
+        typ = VNULL;
+        setFloat(val_); // stays null for NaN and infinity
     }
-    UniValue(const std::string& val_) {
-        setStr(val_);
+    UniValue(std::string val_) {
+        setStr(std::move(val_));
     }
     UniValue(const char *val_) {
-        std::string s(val_);
-        setStr(s);
+        setStr(val_);
     }
-    ~UniValue() {}
+    // copies load the key index atomically, a lookup on the source may
+    // publish it at the same time
+    UniValue(const UniValue& other);
+    UniValue(UniValue&&) = default;
+    UniValue& operator=(const UniValue& other);
+    UniValue& operator=(UniValue&&) = default;
+    ~UniValue() = default;
 
     void clear();
 
@@ -56,13 +67,18 @@ public:
     bool setInt(uint64_t val);
     bool setInt(int64_t val);
     bool setInt(int val) { return setInt((int64_t)val); }
+    // fails for NaN and infinity
     bool setFloat(double val);
-    bool setStr(const std::string& val);
+    bool setStr(std::string val);
     bool setArray();
     bool setObject();
 
     enum VType getType() const { return typ; }
+    // the string, or the text of a bool; numbers are kept in binary and
+    // have their text here only if the binary value can't restore it
     const std::string& getValStr() const { return val; }
+    // the text of a number, formatted from the binary value
+    std::string getNumStr() const;
     bool empty() const { return (values.size() == 0); }
 
     size_t size() const { return values.size(); }
@@ -84,66 +100,133 @@ public:
     bool isObject() const { return (typ == VOBJ); }
 
     bool push_back(const UniValue& val);
-    bool push_back(const std::string& val_) {
-        UniValue tmpVal(VSTR, val_);
-        return push_back(tmpVal);
+    bool push_back(UniValue&& val);
+    bool push_back(std::string val_) {
+        return push_back(UniValue(VSTR, std::move(val_)));
     }
     bool push_back(const char *val_) {
-        std::string s(val_);
-        return push_back(s);
+        return push_back(UniValue(VSTR, val_));
     }
     bool push_backV(const std::vector<UniValue>& vec);
+    bool push_backV(std::vector<UniValue>&& vec);
+
+    // construct the new element in place, the arguments are passed to a
+    // UniValue constructor
+    template <typename... Args>
+    bool emplace_back(Args&&... args) {
+        if (typ != VARR)
+            return false;
+        values.emplace_back(std::forward<Args>(args)...);
+        return true;
+    }
 
     bool pushKV(const std::string& key, const UniValue& val);
-    bool pushKV(const std::string& key, const std::string& val) {
-        UniValue tmpVal(VSTR, val);
-        return pushKV(key, tmpVal);
+    bool pushKV(std::string key, UniValue&& val);
+    bool pushKV(const std::string& key, std::string val) {
+        return pushKV(key, UniValue(VSTR, std::move(val)));
     }
     bool pushKV(const std::string& key, const char *val_) {
-        std::string val(val_);
-        return pushKV(key, val);
+        return pushKV(key, UniValue(VSTR, val_));
     }
     bool pushKV(const std::string& key, int64_t val) {
-        UniValue tmpVal(val);
-        return pushKV(key, tmpVal);
+        return pushKV(key, UniValue(val));
     }
     bool pushKV(const std::string& key, uint64_t val) {
-        UniValue tmpVal(val);
-        return pushKV(key, tmpVal);
+        return pushKV(key, UniValue(val));
     }
     bool pushKV(const std::string& key, int val) {
-        UniValue tmpVal((int64_t)val);
-        return pushKV(key, tmpVal);
+        return pushKV(key, UniValue((int64_t)val));
     }
     bool pushKV(const std::string& key, double val) {
-        UniValue tmpVal(val);
-        return pushKV(key, tmpVal);
+        return pushKV(key, UniValue(val));
     }
     bool pushKVs(const UniValue& obj);
 
+    // pushKV() constructing the value in place
+    template <typename... Args>
+    bool emplaceKV(std::string key, Args&&... args) {
+        if (typ != VOBJ)
+            return false;
+        keys.push_back(std::move(key));
+        values.emplace_back(std::forward<Args>(args)...);
+        keyIndex.reset();
+        return true;
+    }
+
     std::string write(unsigned int prettyIndent = 0,
                       unsigned int indentLevel = 0) const;
 
-    bool read(const char *raw);
+    // parses up to len bytes or up to a NUL byte
+    bool read(const char *raw, size_t len);
+    bool read(const char *raw) {
+        return read(raw, strlen(raw));
+    }
     bool read(const std::string& rawStr) {
-        return read(rawStr.c_str());
+        return read(rawStr.data(), rawStr.size());
     }
 
 private:
     UniValue::VType typ;
-    std::string val;                       // numbers are stored as C++ strings
+    std::string val;                       // for numbers only the text that
+                                           // the binary value can't restore
     std::vector<std::string> keys;
     std::vector<UniValue> values;
 
+    // hash index over keys, built on the first lookup in larger objects and
+    // dropped when keys change; copies share it until they get modified
+    struct KeyIndex;
+    mutable std::shared_ptr<const KeyIndex> keyIndex;
+
+    // which member of num holds a number, NUM_TEXT if only val does (out of
+    // range for a double)
+    enum NumTag { NUM_NONE, NUM_INT64, NUM_UINT64, NUM_DOUBLE, NUM_TEXT };
+    NumTag numTag = NUM_NONE;
+    union {
+        int64_t i64;
+        uint64_t u64;
+        double dbl;
+    } num;
+
+    void setNumText(const std::string& text);
     int findKey(const std::string& key) const;
     void writeArray(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
     void writeObject(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
 
 public:
+    // (key, value) pair of an object, refers to the object's own storage
+    typedef std::pair<const std::string&, const UniValue&> KeyValue;
+
+    class const_kv_iterator {
+    public:
+        const_kv_iterator(const std::string *key_, const UniValue *value_) : key(key_), value(value_) {}
+        KeyValue operator*() const { return KeyValue(*key, *value); }
+        const_kv_iterator& operator++() { ++key; ++value; return *this; }
+        bool operator==(const const_kv_iterator& other) const { return value == other.value; }
+        bool operator!=(const const_kv_iterator& other) const { return value != other.value; }
+    private:
+        const std::string *key;
+        const UniValue *value;
+    };
+
+    class KeyValueRange {
+    public:
+        KeyValueRange(const_kv_iterator begin_, const_kv_iterator end_) : first(begin_), last(end_) {}
+        const_kv_iterator begin() const { return first; }
+        const_kv_iterator end() const { return last; }
+    private:
+        const_kv_iterator first;
+        const_kv_iterator last;
+    };
+
     // Strict type-specific getters, these throw std::runtime_error if the
     // value is of unexpected type
-    std::vector<std::string> getKeys() const;
-    std::vector<UniValue> getValues() const;
+    // the containers are returned by reference and stay valid until the
+    // value gets modified
+    const std::vector<std::string>& getKeys() const;
+    const std::vector<UniValue>& getValues() const;
+    // iterate over the (key, value) pairs of an object without copying:
+    //   for (UniValue::KeyValue kv : obj.getKeyValues()) ...
+    KeyValueRange getKeyValues() const;
     bool get_bool() const;
     std::string get_str() const;
     int get_int() const;
@@ -154,9 +237,10 @@ public:
 
     enum VType type() const { return getType(); }
     bool push_back(std::pair<std::string,UniValue> pear) {
-        return pushKV(pear.first, pear.second);
+        return pushKV(std::move(pear.first), std::move(pear.second));
     }
     friend const UniValue& find_value( const UniValue& obj, const std::string& name);
+    friend class UniValueBuilder;
 };
 
 //
@@ -165,62 +249,57 @@ public:
 //
 static inline std::pair<std::string,UniValue> Pair(const char *cKey, const char *cVal)
 {
-    std::string key(cKey);
-    UniValue uVal(cVal);
-    return std::make_pair(key, uVal);
+    return std::make_pair(std::string(cKey), UniValue(cVal));
 }
 
 static inline std::pair<std::string,UniValue> Pair(const char *cKey, std::string strVal)
 {
-    std::string key(cKey);
-    UniValue uVal(strVal);
-    return std::make_pair(key, uVal);
+    return std::make_pair(std::string(cKey), UniValue(std::move(strVal)));
 }
 
 static inline std::pair<std::string,UniValue> Pair(const char *cKey, uint64_t u64Val)
 {
-    std::string key(cKey);
-    UniValue uVal(u64Val);
-    return std::make_pair(key, uVal);
+    return std::make_pair(std::string(cKey), UniValue(u64Val));
 }
 
 static inline std::pair<std::string,UniValue> Pair(const char *cKey, int64_t i64Val)
 {
-    std::string key(cKey);
-    UniValue uVal(i64Val);
-    return std::make_pair(key, uVal);
+    return std::make_pair(std::string(cKey), UniValue(i64Val));
 }
 
 static inline std::pair<std::string,UniValue> Pair(const char *cKey, bool iVal)
 {
-    std::string key(cKey);
-    UniValue uVal(iVal);
-    return std::make_pair(key, uVal);
+    return std::make_pair(std::string(cKey), UniValue(iVal));
 }
 
 static inline std::pair<std::string,UniValue> Pair(const char *cKey, int iVal)
 {
-    std::string key(cKey);
-    UniValue uVal(iVal);
-    return std::make_pair(key, uVal);
+    return std::make_pair(std::string(cKey), UniValue(iVal));
 }
 
 static inline std::pair<std::string,UniValue> Pair(const char *cKey, double dVal)
 {
-    std::string key(cKey);
-    UniValue uVal(dVal);
-    return std::make_pair(key, uVal);
+    return std::make_pair(std::string(cKey), UniValue(dVal));
 }
 
 static inline std::pair<std::string,UniValue> Pair(const char *cKey, const UniValue& uVal)
 {
-    std::string key(cKey);
-    return std::make_pair(key, uVal);
+    return std::make_pair(std::string(cKey), uVal);
+}
+
+static inline std::pair<std::string,UniValue> Pair(const char *cKey, UniValue&& uVal)
+{
+    return std::make_pair(std::string(cKey), std::move(uVal));
 }
 
 static inline std::pair<std::string,UniValue> Pair(std::string key, const UniValue& uVal)
 {
-    return std::make_pair(key, uVal);
+    return std::make_pair(std::move(key), uVal);
+}
+
+static inline std::pair<std::string,UniValue> Pair(std::string key, UniValue&& uVal)
+{
+    return std::make_pair(std::move(key), std::move(uVal));
 }
 
 enum jtokentype {
@@ -239,6 +318,22 @@ enum jtokentype {
     JTOK_STRING,
 };
 
+// a token as a range of the input: the digits of a number, or the characters
+// between the quotes of a string, still escaped if escaped is set
+struct JsonTokenView {
+    const char *data;
+    size_t len;
+    bool escaped;
+};
+
+// tokenizes [raw, end) without copying, a NUL byte ends the input as well
+extern enum jtokentype getJsonTokenView(JsonTokenView& token,
+                                        unsigned int& consumed,
+                                        const char *raw, const char *end);
+// decodes the escapes of a string token validated by getJsonTokenView()
+extern void unescapeJsonString(const char *s, size_t len, std::string& out);
+// getJsonTokenView() for a NUL terminated input, copying the token into
+// tokenVal; use getJsonTokenView() to loop over a document
 extern enum jtokentype getJsonToken(std::string& tokenVal,
                                     unsigned int& consumed, const char *raw);
 extern const char *uvTypeName(UniValue::VType t);
@@ -247,4 +342,66 @@ extern const UniValue NullUniValue;
 
 const UniValue& find_value( const UniValue& obj, const std::string& name);
 
+//
+// Streaming reader: readJsonEvents() validates the document like
+// UniValue::read() but, instead of building a tree, reports every element to
+// a handler. Returning false from an event stops the parse (readJsonEvents()
+// then returns false). The strings passed to the events are only valid
+// during the call. Trailing data after the top-level value fails the parse,
+// the events up to there have been reported already.
+//
+class UniValueEventHandler {
+public:
+    virtual ~UniValueEventHandler() {}
+
+    virtual bool startObject() { return true; }
+    virtual bool endObject() { return true; }
+    virtual bool startArray() { return true; }
+    virtual bool endArray() { return true; }
+    // name of the next member of the current object
+    virtual bool key(const std::string&) { return true; }
+    virtual bool str(const std::string&) { return true; }
+    // number in its JSON notation
+    virtual bool num(const std::string&) { return true; }
+    virtual bool boolean(bool) { return true; }
+    virtual bool null() { return true; }
+};
+
+extern bool readJsonEvents(const char *raw, size_t len, UniValueEventHandler& handler);
+extern bool readJsonEvents(const char *raw, UniValueEventHandler& handler);
+
+// builds a UniValue out of the events, this is how UniValue::read() works;
+// a handler can forward the events of a single subtree to a builder to
+// materialize only that part of a document
+class UniValueBuilder : public UniValueEventHandler {
+public:
+    explicit UniValueBuilder(UniValue& rootIn) : root(rootIn) {}
+
+    bool startObject() { return open(UniValue::VOBJ); }
+    bool endObject() { return close(); }
+    bool startArray() { return open(UniValue::VARR); }
+    bool endArray() { return close(); }
+    bool key(const std::string& name) { pendingKey = name; return true; }
+    bool str(const std::string& val) { return add(UniValue::VSTR, val); }
+    bool num(const std::string& val) { return add(UniValue::VNUM, val); }
+    bool boolean(bool val) { return add(UniValue::VBOOL, val ? "1" : ""); }
+    bool null() { return add(UniValue::VNULL, ""); }
+
+    // true once the root container got closed
+    bool complete() const { return closed; }
+
+private:
+    UniValue& root;
+    std::vector<UniValue*> stack;
+    std::string pendingKey;
+    bool closed = false;
+
+    UniValue *append(UniValue::VType type, const std::string& val);
+    bool open(UniValue::VType type);
+    bool close();
+    bool add(UniValue::VType type, const std::string& val) {
+        return append(type, val) != NULL;
+    }
+};
+
 #endif // BITCOIN_UNIVALUE_UNIVALUE_H
@@ -0,0 +1,127 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+
+static std::atomic<uint64_t> allocationCount(0);
+
+//count every heap allocation of the benchmark binary, allocations done over
+//malloc (OpenSSL, C code) are not covered
+void* operator new(size_t size)
+{
+    allocationCount++;
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    free(ptr);
+}
+
+namespace benchmark
+{
+uint64_t AllocationCount()
+{
+    return allocationCount;
+}
+
+State::State(size_t payloadSizeIn, std::chrono::nanoseconds minTimeIn) : payloadSize(payloadSizeIn), minTime(minTimeIn), elapsed(0), count(0), countMask(0), allocStart(0), allocs(0), bytesPerOp(0)
+{
+}
+
+bool State::KeepRunning()
+{
+    if (count & countMask) {
+        ++count;
+        return true;
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (count == 0) {
+        startTime = now;
+        allocStart = AllocationCount();
+    } else {
+        elapsed = now - startTime;
+        if (elapsed >= minTime) {
+            allocs = AllocationCount() - allocStart;
+            return false;
+        }
+        //read the clock less often for fast operations
+        if (elapsed * 16 < minTime && countMask < (1 << 20) - 1)
+            countMask = countMask * 2 + 1;
+    }
+    ++count;
+    return true;
+}
+
+void State::GetResult(Result& result) const
+{
+    result.payloadSize = payloadSize;
+    result.iterations = count;
+    result.nsPerOp = count ? (double)elapsed.count() / count : 0;
+    result.bytesPerSecond = (bytesPerOp && elapsed.count()) ? (double)bytesPerOp * count * 1e9 / elapsed.count() : 0;
+    result.allocsPerOp = count ? (double)allocs / count : 0;
+}
+
+std::map<std::string, BenchRunner::Bench>& BenchRunner::benchmarks()
+{
+    static std::map<std::string, Bench> benchmarks_map;
+    return benchmarks_map;
+}
+
+BenchRunner::BenchRunner(const std::string& name, BenchFunction func, bool sized)
+{
+    Bench bench;
+    bench.func = func;
+    bench.sized = sized;
+    benchmarks().insert(std::make_pair(name, bench));
+}
+
+std::vector<Result> BenchRunner::RunAll(const std::string& filter, const std::vector<size_t>& payloadSizes, std::chrono::nanoseconds minTime)
+{
+    std::vector<Result> results;
+    for (const auto& it : benchmarks()) {
+        if (it.first.find(filter) == std::string::npos)
+            continue;
+
+        std::vector<size_t> sizes = it.second.sized ? payloadSizes : std::vector<size_t>(1, 0);
+        for (size_t size : sizes) {
+            State state(size, minTime);
+            it.second.func(state);
+
+            Result result;
+            result.name = it.first;
+            state.GetResult(result);
+            results.push_back(result);
+        }
+    }
+    return results;
+}
+
+std::vector<std::string> BenchRunner::List()
+{
+    std::vector<std::string> names;
+    for (const auto& it : benchmarks())
+        names.push_back(it.first);
+    return names;
+}
+}
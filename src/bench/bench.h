@@ -0,0 +1,108 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef DBB_BENCH_BENCH_H
+#define DBB_BENCH_BENCH_H
+
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+//microbenchmarks for the libdbb/univalue hot paths
+//
+//a benchmark is a function looping over State::KeepRunning(), everything
+//before the loop is setup and is not measured:
+//
+//  static void Base64Encode(benchmark::State& state)
+//  {
+//      std::string data(state.payloadSize, 'a');
+//      state.SetBytesPerOp(data.size());
+//      while (state.KeepRunning())
+//          benchmark::DoNotOptimize(base64_encode(...));
+//  }
+//  BENCHMARK_SIZED(Base64Encode);
+//
+//sized benchmarks run once for every configured payload size
+namespace benchmark
+{
+//heap allocations (operator new) since the program started
+uint64_t AllocationCount();
+
+//keep the compiler from removing a computation whose result is unused
+template <typename T>
+inline void DoNotOptimize(const T& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+class Result
+{
+public:
+    std::string name;
+    size_t payloadSize;
+    uint64_t iterations;
+    double nsPerOp;
+    double bytesPerSecond; //0 if the benchmark does not process a payload
+    double allocsPerOp;
+};
+
+class State
+{
+public:
+    const size_t payloadSize;
+
+    State(size_t payloadSizeIn, std::chrono::nanoseconds minTimeIn);
+
+    //returns true as long as the benchmark should do another iteration
+    bool KeepRunning();
+
+    //amount of bytes processed by one iteration (for bytes/s)
+    void SetBytesPerOp(size_t bytes) { bytesPerOp = bytes; }
+
+    //fill the result, only valid after KeepRunning() returned false
+    void GetResult(Result& result) const;
+
+private:
+    std::chrono::nanoseconds minTime;
+    std::chrono::steady_clock::time_point startTime;
+    std::chrono::nanoseconds elapsed;
+    uint64_t count;
+    uint64_t countMask; //the clock is only read every countMask+1 iterations
+    uint64_t allocStart;
+    uint64_t allocs;
+    size_t bytesPerOp;
+};
+
+typedef std::function<void(State&)> BenchFunction;
+
+class BenchRunner
+{
+public:
+    BenchRunner(const std::string& name, BenchFunction func, bool sized);
+
+    //run all benchmarks whose name contains filter
+    static std::vector<Result> RunAll(const std::string& filter, const std::vector<size_t>& payloadSizes, std::chrono::nanoseconds minTime);
+
+    //returns the names of all registered benchmarks
+    static std::vector<std::string> List();
+
+private:
+    class Bench
+    {
+    public:
+        BenchFunction func;
+        bool sized;
+    };
+    static std::map<std::string, Bench>& benchmarks();
+};
+}
+
+#define BENCHMARK(n) static benchmark::BenchRunner bench_runner_##n(#n, n, false);
+#define BENCHMARK_SIZED(n) static benchmark::BenchRunner bench_runner_##n(#n, n, true);
+
+#endif // DBB_BENCH_BENCH_H
@@ -0,0 +1,90 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbb_util.h"
+#include "univalue.h"
+
+#include "key.h"
+
+static std::vector<size_t> ParseSizes(const std::string& str)
+{
+    std::vector<size_t> sizes;
+    size_t pos = 0;
+    while (pos < str.size()) {
+        size_t end = str.find(',', pos);
+        if (end == std::string::npos)
+            end = str.size();
+        long size = atol(str.substr(pos, end - pos).c_str());
+        if (size > 0)
+            sizes.push_back(size);
+        pos = end + 1;
+    }
+    return sizes;
+}
+
+int main(int argc, char** argv)
+{
+    DBB::ParseParameters(argc, argv);
+
+    if (DBB::mapArgs.count("-help") || DBB::mapArgs.count("-?")) {
+        printf("Usage: bench_dbb [options]\n\n"
+               "  -filter=<str>      only run benchmarks containing <str>\n"
+               "  -sizes=<n,n,...>   payload sizes in bytes (default: 64,1024,16384)\n"
+               "  -time=<ms>         minimal run time per benchmark (default: 250)\n"
+               "  -json              print the results as json\n"
+               "  -list              list the available benchmarks\n");
+        return 0;
+    }
+
+    if (DBB::mapArgs.count("-list")) {
+        for (const std::string& name : benchmark::BenchRunner::List())
+            printf("%s\n", name.c_str());
+        return 0;
+    }
+
+    std::vector<size_t> sizes = ParseSizes(DBB::GetArg("-sizes", "64,1024,16384"));
+    if (sizes.empty()) {
+        fprintf(stderr, "Error: invalid -sizes\n");
+        return 1;
+    }
+    std::chrono::milliseconds minTime(atoi(DBB::GetArg("-time", "250").c_str()));
+
+    //the wallet benchmarks need the secp256k1 context
+    ECC_Start();
+    std::vector<benchmark::Result> results = benchmark::BenchRunner::RunAll(DBB::GetArg("-filter", ""), sizes, minTime);
+    ECC_Stop();
+
+    if (DBB::mapArgs.count("-json")) {
+        UniValue jsonResults(UniValue::VARR);
+        for (const benchmark::Result& result : results) {
+            UniValue jsonResult(UniValue::VOBJ);
+            jsonResult.push_back(Pair("name", result.name));
+            jsonResult.push_back(Pair("size", (uint64_t)result.payloadSize));
+            jsonResult.push_back(Pair("iterations", result.iterations));
+            jsonResult.push_back(Pair("ns_per_op", result.nsPerOp));
+            jsonResult.push_back(Pair("bytes_per_second", result.bytesPerSecond));
+            jsonResult.push_back(Pair("allocs_per_op", result.allocsPerOp));
+            jsonResults.push_back(jsonResult);
+        }
+        printf("%s\n", jsonResults.write(2).c_str());
+        return 0;
+    }
+
+    printf("%-30s %8s %12s %14s %12s %12s\n", "# benchmark", "size", "iterations", "ns/op", "MB/s", "allocs/op");
+    for (const benchmark::Result& result : results) {
+        char size[32] = "-";
+        char throughput[32] = "-";
+        if (result.payloadSize)
+            snprintf(size, sizeof(size), "%lu", (unsigned long)result.payloadSize);
+        if (result.bytesPerSecond > 0)
+            snprintf(throughput, sizeof(throughput), "%.2f", result.bytesPerSecond / (1024 * 1024));
+        printf("%-30s %8s %12llu %14.1f %12s %12.2f\n", result.name.c_str(), size, (unsigned long long)result.iterations, result.nsPerOp, throughput, result.allocsPerOp);
+    }
+    return 0;
+}
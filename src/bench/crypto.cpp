@@ -0,0 +1,147 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "dbb.h"
+#include "dbb_util.h"
+#include "libdbb/crypto.h"
+#include "univalue.h"
+
+//a json command of roughly size bytes (like a sign command carrying hashes)
+static std::string JSONCommand(size_t size)
+{
+    std::string command = "{\"sign\":{\"type\":\"hash\",\"data\":\"";
+    while (command.size() + 4 < size)
+        command += "0123456789abcdef"[command.size() % 16];
+    return command + "\"}}";
+}
+
+//the response of the device to an encrypted command of size bytes
+static std::string EncryptedResponse(const DBB::SessionKey& key, size_t size)
+{
+    std::string base64str;
+    DBB::encryptAndEncodeCommand(JSONCommand(size), key, base64str);
+    return "{\"ciphertext\":\"" + base64str + "\"}";
+}
+
+static void EncryptAndEncodeCommand(benchmark::State& state)
+{
+    DBB::SessionKey key("0000");
+    std::string command = JSONCommand(state.payloadSize);
+    std::string base64str;
+    state.SetBytesPerOp(command.size());
+    while (state.KeepRunning()) {
+        DBB::encryptAndEncodeCommand(command, key, base64str);
+        benchmark::DoNotOptimize(base64str);
+    }
+}
+
+static void EncryptAndEncodeCommandBuffer(benchmark::State& state)
+{
+    DBB::SessionKey key("0000");
+    std::string command = JSONCommand(state.payloadSize);
+    std::vector<char> out(DBB::encryptedCommandSize(command.size()));
+    state.SetBytesPerOp(command.size());
+    while (state.KeepRunning())
+        benchmark::DoNotOptimize(DBB::encryptAndEncodeCommand(command.data(), command.size(), key, &out[0], out.size()));
+}
+
+static void DecryptAndDecodeCommand(benchmark::State& state)
+{
+    DBB::SessionKey key("0000");
+    std::string response = EncryptedResponse(key, state.payloadSize);
+    std::string plaintext;
+    state.SetBytesPerOp(state.payloadSize);
+    while (state.KeepRunning()) {
+        DBB::decryptAndDecodeCommand(response, key, plaintext);
+        benchmark::DoNotOptimize(plaintext);
+    }
+}
+
+static void DecryptAndParseCommand(benchmark::State& state)
+{
+    DBB::SessionKey key("0000");
+    std::string response = EncryptedResponse(key, state.payloadSize);
+    state.SetBytesPerOp(state.payloadSize);
+    while (state.KeepRunning()) {
+        UniValue value;
+        DBB::decryptAndDecodeCommand(response, key, value);
+        benchmark::DoNotOptimize(value);
+    }
+}
+
+static void Base64Encode(benchmark::State& state)
+{
+    std::vector<unsigned char> data(state.payloadSize, 0xa5);
+    state.SetBytesPerOp(data.size());
+    while (state.KeepRunning())
+        benchmark::DoNotOptimize(base64_encode(&data[0], (unsigned int)data.size()));
+}
+
+static void Base64Decode(benchmark::State& state)
+{
+    std::vector<unsigned char> data(state.payloadSize, 0xa5);
+    std::string encoded = base64_encode(&data[0], (unsigned int)data.size());
+    state.SetBytesPerOp(encoded.size());
+    while (state.KeepRunning())
+        benchmark::DoNotOptimize(base64_decode(encoded));
+}
+
+static void Sha256(benchmark::State& state)
+{
+    std::vector<unsigned char> data(state.payloadSize, 0xa5);
+    unsigned char hash[DBB_SHA256_DIGEST_LENGTH];
+    state.SetBytesPerOp(data.size());
+    while (state.KeepRunning()) {
+        sha256(&data[0], data.size(), hash);
+        benchmark::DoNotOptimize(hash);
+    }
+}
+
+//a batch of small messages (like request signatures and copayer ids), payloadSize bytes in total
+static void Sha256Many(benchmark::State& state)
+{
+    const size_t count = 32;
+    size_t len = state.payloadSize / count + 1;
+    std::vector<unsigned char> data(count * len, 0xa5);
+    std::vector<const unsigned char*> messages(count);
+    std::vector<size_t> lens(count, len);
+    for (size_t i = 0; i < count; i++)
+        messages[i] = &data[i * len];
+    std::vector<unsigned char> hashes(count * DBB_SHA256_DIGEST_LENGTH);
+    state.SetBytesPerOp(data.size());
+    while (state.KeepRunning()) {
+        sha256_many(&messages[0], &lens[0], count, &hashes[0]);
+        benchmark::DoNotOptimize(hashes);
+    }
+}
+
+static void HexStr(benchmark::State& state)
+{
+    std::vector<unsigned char> data(state.payloadSize, 0xa5);
+    state.SetBytesPerOp(data.size());
+    while (state.KeepRunning())
+        benchmark::DoNotOptimize(DBB::HexStr(&data[0], &data[0] + data.size()));
+}
+
+static void ParseHex(benchmark::State& state)
+{
+    std::vector<unsigned char> data(state.payloadSize, 0xa5);
+    std::string hex = DBB::HexStr(&data[0], &data[0] + data.size());
+    state.SetBytesPerOp(hex.size());
+    while (state.KeepRunning())
+        benchmark::DoNotOptimize(DBB::ParseHex(hex));
+}
+
+BENCHMARK_SIZED(EncryptAndEncodeCommand);
+BENCHMARK_SIZED(EncryptAndEncodeCommandBuffer);
+BENCHMARK_SIZED(DecryptAndDecodeCommand);
+BENCHMARK_SIZED(DecryptAndParseCommand);
+BENCHMARK_SIZED(Base64Encode);
+BENCHMARK_SIZED(Base64Decode);
+BENCHMARK_SIZED(Sha256);
+BENCHMARK_SIZED(Sha256Many);
+BENCHMARK_SIZED(HexStr);
+BENCHMARK_SIZED(ParseHex);
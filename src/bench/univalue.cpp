@@ -0,0 +1,109 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "univalue.h"
+
+#include <stdlib.h>
+
+//a json document of roughly size bytes, an array of wallet server like objects
+static std::string JSONDocument(size_t size)
+{
+    UniValue document(UniValue::VARR);
+    for (int i = 0; document.write().size() < size; i++) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("txid", "4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b"));
+        entry.push_back(Pair("vout", i));
+        entry.push_back(Pair("satoshis", (int64_t)100000 * i));
+        entry.push_back(Pair("confirmed", (i % 2) == 0));
+        entry.push_back(Pair("path", "m/0/" + std::to_string(i)));
+        document.push_back(entry);
+    }
+    return document.write();
+}
+
+static void UniValueRead(benchmark::State& state)
+{
+    std::string json = JSONDocument(state.payloadSize);
+    state.SetBytesPerOp(json.size());
+    while (state.KeepRunning()) {
+        UniValue value;
+        value.read(json);
+        benchmark::DoNotOptimize(value);
+    }
+}
+
+//pulls a single field out of every entry without building a UniValue
+class SatoshisHandler : public UniValueEventHandler
+{
+public:
+    int64_t total = 0;
+    bool key(const std::string& name) { isSatoshis = (name == "satoshis"); return true; }
+    bool num(const std::string& val) { if (isSatoshis) total += atoll(val.c_str()); return true; }
+private:
+    bool isSatoshis = false;
+};
+
+static void UniValueReadEvents(benchmark::State& state)
+{
+    std::string json = JSONDocument(state.payloadSize);
+    state.SetBytesPerOp(json.size());
+    while (state.KeepRunning()) {
+        SatoshisHandler handler;
+        readJsonEvents(json.data(), json.size(), handler);
+        benchmark::DoNotOptimize(handler.total);
+    }
+}
+
+static void UniValueWrite(benchmark::State& state)
+{
+    UniValue value;
+    value.read(JSONDocument(state.payloadSize));
+    state.SetBytesPerOp(value.write().size());
+    while (state.KeepRunning())
+        benchmark::DoNotOptimize(value.write());
+}
+
+//a few lookups in a wallet server like txp object with 40 keys
+static void UniValueFindValue(benchmark::State& state)
+{
+    UniValue txp(UniValue::VOBJ);
+    for (int i = 0; i < 36; i++)
+        txp.push_back(Pair("field" + std::to_string(i), i));
+    txp.push_back(Pair("toAddress", "mhAXgLYG3Zy8d2yRzNkS2BEr5DFzkSmeqy"));
+    txp.push_back(Pair("amount", (int64_t)100000));
+    txp.push_back(Pair("inputs", UniValue(UniValue::VARR)));
+    txp.push_back(Pair("changeAddress", UniValue(UniValue::VOBJ)));
+
+    const char* names[] = {"toAddress", "amount", "inputs", "changeAddress", "missing"};
+    std::vector<std::string> lookups(names, names + 5);
+    while (state.KeepRunning()) {
+        for (const std::string& name : lookups)
+            benchmark::DoNotOptimize(find_value(txp, name));
+    }
+}
+
+//the numeric fields of a wallet server like input, as read by ParseTxProposal
+static void UniValueGetNumber(benchmark::State& state)
+{
+    UniValue input;
+    input.read("{\"vout\":1,\"satoshis\":100000000,\"amount\":2500000,\"fee\":10000}");
+    const UniValue& vout = find_value(input, "vout");
+    const UniValue& satoshis = find_value(input, "satoshis");
+    const UniValue& amount = find_value(input, "amount");
+    const UniValue& fee = find_value(input, "fee");
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(vout.get_int());
+        benchmark::DoNotOptimize(satoshis.get_int64());
+        benchmark::DoNotOptimize(amount.get_int64());
+        benchmark::DoNotOptimize(fee.get_int64());
+    }
+}
+
+BENCHMARK_SIZED(UniValueRead);
+BENCHMARK_SIZED(UniValueReadEvents);
+BENCHMARK_SIZED(UniValueWrite);
+BENCHMARK(UniValueFindValue);
+BENCHMARK(UniValueGetNumber);
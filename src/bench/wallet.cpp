@@ -0,0 +1,118 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "libbitpay-wallet-client/bpwalletclient.h"
+
+#include "base58.h"
+#include "utilstrencodings.h"
+
+#define BENCH_TXPROPOSAL_INPUTS 3
+#define BENCH_VERIFY_SIGNATURES 16
+
+static std::string BenchAddress(const CKey& key)
+{
+    return CBitcoinAddress(key.GetPubKey().GetID()).ToString();
+}
+
+//a 2-of-3 multisig transaction proposal as delivered by the wallet server
+static UniValue TxProposal(int nInputs)
+{
+    std::vector<CKey> keys(3);
+    for (size_t i = 0; i < keys.size(); i++) {
+        unsigned char secret[32];
+        memset(secret, (int)i + 1, sizeof(secret));
+        keys[i].Set(secret, secret + sizeof(secret), true);
+    }
+
+    UniValue proposal(UniValue::VOBJ);
+    proposal.push_back(Pair("id", "bench-proposal"));
+    proposal.push_back(Pair("toAddress", BenchAddress(keys[0])));
+    proposal.push_back(Pair("amount", (int64_t)100000));
+    proposal.push_back(Pair("fee", (int64_t)10000));
+    UniValue outputOrder(UniValue::VARR);
+    outputOrder.push_back(0);
+    outputOrder.push_back(1);
+    proposal.push_back(Pair("outputOrder", outputOrder));
+    proposal.push_back(Pair("requiredSignatures", 2));
+
+    UniValue inputs(UniValue::VARR);
+    for (int i = 0; i < nInputs; i++) {
+        UniValue input(UniValue::VOBJ);
+        input.push_back(Pair("txid", "4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b"));
+        input.push_back(Pair("vout", i));
+        input.push_back(Pair("satoshis", 500000));
+        input.push_back(Pair("path", "m/0/" + std::to_string(i)));
+        UniValue publicKeys(UniValue::VARR);
+        for (const CKey& key : keys)
+            publicKeys.push_back(HexStr(key.GetPubKey()));
+        input.push_back(Pair("publicKeys", publicKeys));
+        inputs.push_back(input);
+    }
+    proposal.push_back(Pair("inputs", inputs));
+
+    UniValue changeAddress(UniValue::VOBJ);
+    changeAddress.push_back(Pair("address", BenchAddress(keys[1])));
+    proposal.push_back(Pair("changeAddress", changeAddress));
+    return proposal;
+}
+
+static void ParseTxProposal(benchmark::State& state)
+{
+    BitPayWalletClient client;
+    UniValue proposal = TxProposal(BENCH_TXPROPOSAL_INPUTS);
+    while (state.KeepRunning()) {
+        std::vector<std::pair<std::string, uint256> > inputHashes;
+        benchmark::DoNotOptimize(client.ParseTxProposal(proposal, inputHashes));
+    }
+}
+
+static void EcdsaSigToDER(benchmark::State& state)
+{
+    //R with the MSB set (gets a zero prefix), S with leading zeros
+    uint8_t sig[64];
+    for (int i = 0; i < 32; i++)
+        sig[i] = 0x80 + i;
+    for (int i = 32; i < 64; i++)
+        sig[i] = (i < 34) ? 0 : i;
+
+    uint8_t der[74];
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(ecdsa_sig_to_der(sig, der));
+        benchmark::DoNotOptimize(der);
+    }
+}
+
+//device signatures (compact R|S) of a larger proposal
+static void VerifyInputSignatures(benchmark::State& state)
+{
+    CKey key;
+    unsigned char secret[32];
+    memset(secret, 0x42, sizeof(secret));
+    key.Set(secret, secret + sizeof(secret), true);
+    std::string pubKeyHex = HexStr(key.GetPubKey());
+
+    std::vector<std::pair<std::string, uint256> > inputHashes;
+    std::vector<std::string> sigs;
+    std::vector<std::string> pubKeys;
+    for (int i = 0; i < BENCH_VERIFY_SIGNATURES; i++) {
+        unsigned char hashData[32];
+        memset(hashData, i + 1, sizeof(hashData));
+        uint256 hash(std::vector<unsigned char>(hashData, hashData + sizeof(hashData)));
+        std::vector<unsigned char> sigCompact;
+        key.SignCompact(hash, sigCompact);
+        inputHashes.push_back(std::make_pair("0/" + std::to_string(i), hash));
+        sigs.push_back(HexStr(sigCompact.begin() + 1, sigCompact.end())); //strip the recovery id
+        pubKeys.push_back(pubKeyHex);
+    }
+
+    std::vector<bool> valid;
+    while (state.KeepRunning())
+        benchmark::DoNotOptimize(BitPayWalletClient::VerifyInputSignatures(inputHashes, sigs, pubKeys, valid));
+}
+
+BENCHMARK(ParseTxProposal);
+BENCHMARK(EcdsaSigToDER);
+BENCHMARK(VerifyInputSignatures);
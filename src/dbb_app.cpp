@@ -43,6 +43,7 @@
 
 #include "dbb.h"
 #include "dbb_util.h"
+#include "libdbb/hotplug.h"
 
 #include "univalue.h"
 #include "libbitpay-wallet-client/bpwalletclient.h"
@@ -76,18 +77,18 @@ std::condition_variable queueCondVar;
 std::mutex cs_queue;
 
 //TODO: migrate tuple to a class
-typedef std::tuple<std::string, std::string, std::function<void(const std::string&, dbb_cmd_execution_status_t status)> > t_cmdCB;
+typedef std::tuple<DBB::SecureString, DBB::SessionKeyRef, std::function<void(const UniValue&, dbb_cmd_execution_status_t status)>, int, DBB::CancellationTokenRef> t_cmdCB;
 std::queue<t_cmdCB> cmdQueue;
 std::atomic<bool> stopThread;
-std::atomic<bool> notified;
 
 //executeCommand adds a command to the thread queue and notifies the tread to work down the queue
-void executeCommand(const std::string& cmd, const std::string& password, std::function<void(const std::string&, dbb_cmd_execution_status_t status)> cmdFinished)
+DBB::CancellationTokenRef executeCommand(const DBB::SecureString& cmd, const DBB::SessionKeyRef& key, std::function<void(const UniValue&, dbb_cmd_execution_status_t status)> cmdFinished, int timeoutMS)
 {
+    DBB::CancellationTokenRef token(new DBB::CancellationToken());
     std::unique_lock<std::mutex> lock(cs_queue);
-    cmdQueue.push(t_cmdCB(cmd, password, cmdFinished));
-    notified = true;
+    cmdQueue.push(t_cmdCB(cmd, key, cmdFinished, timeoutMS, token));
     queueCondVar.notify_one();
+    return token;
 }
 
 //simple function for the LED blick command
@@ -96,7 +97,8 @@ static void led_blink(struct evhttp_request* req, void* arg)
     printf("Received a request for %s\nDispatching dbb command\n", evhttp_request_get_uri(req));
 
     //dispatch command
-    executeCommand("{\"led\" : \"toggle\"}", "0000", [](const std::string& cmdOut, dbb_cmd_execution_status_t status) {
+    static DBB::SessionKeyRef defaultKey(new DBB::SessionKey("0000"));
+    executeCommand("{\"led\" : \"toggle\"}", defaultKey, [](const UniValue& response, dbb_cmd_execution_status_t status) {
     });
 
     //form a response, mind, no cmd result is available at this point, at the moment we don't block the http response thread
@@ -129,66 +131,97 @@ int main(int argc, char** argv)
 
     //TODO: factor out thread
     std::thread cmdThread([&]() {
-        //TODO, the locking is to broad at the moment
-        //  during executing a command the queue is locked
-        //  and therefore no new commands can be added
-        //  copy the command and callback and release the lock
-        //  would be a solution
-
-        std::unique_lock<std::mutex> lock(cs_queue);
         while (!stopThread) {
-            while (!notified) {  // loop to avoid spurious wakeups
-                queueCondVar.wait(lock);
+            //only hold the lock while taking the command from the queue,
+            //new commands can be added while the device is busy
+            t_cmdCB cmdCB;
+            {
+                std::unique_lock<std::mutex> lock(cs_queue);
+                while (cmdQueue.empty() && !stopThread) // loop to avoid spurious wakeups
+                    queueCondVar.wait(lock);
+                if (stopThread)
+                    break;
+                cmdCB = std::move(cmdQueue.front());
+                cmdQueue.pop();
             }
-            while (!cmdQueue.empty()) {
-                std::string cmdOut;
-                t_cmdCB cmdCB = cmdQueue.front();
-                std::string cmd = std::get<0>(cmdCB);
-                std::string password = std::get<1>(cmdCB);
-                dbb_cmd_execution_status_t status = DBB_CMD_EXECUTION_STATUS_OK;
-
-                if (!password.empty())
+
+            std::string cmdOut;
+            const DBB::SecureString& cmd = std::get<0>(cmdCB);
+            DBB::SessionKeyRef key = std::get<1>(cmdCB);
+            int timeoutMS = std::get<3>(cmdCB);
+            DBB::CancellationTokenRef token = std::get<4>(cmdCB);
+            dbb_cmd_execution_status_t status = DBB_CMD_EXECUTION_STATUS_OK;
+            DBB::dbb_command_status_t sendStatus = DBB::DBB_COMMAND_STATUS_OK;
+
+            UniValue response;
+
+            if (key)
+            {
+                try
                 {
-                    std::string base64str;
-                    std::string unencryptedJson;
-                    try
-                    {
-                        DebugOut("sendcmd", "encrypt&send: %s\n", cmd.c_str());
-                        DBB::encryptAndEncodeCommand(cmd, password, base64str);
-                        if (!DBB::sendCommand(base64str, cmdOut))
-                        {
-                            DebugOut("sendcmd", "sending command failed\n");
-                            status = DBB_CMD_EXECUTION_STATUS_ENCRYPTION_FAILED;
-                        }
-                        else
-                            DBB::decryptAndDecodeCommand(cmdOut, password, unencryptedJson);
-                    }
-                    catch (const std::exception& ex) {
-                        unencryptedJson = cmdOut;
-                        DebugOut("sendcmd", "response decryption failed: %s\n", unencryptedJson.c_str());
-                        status = DBB_CMD_EXECUTION_STATUS_ENCRYPTION_FAILED;
-                    }
-
-                    cmdOut = unencryptedJson;
+                    DebugOut("sendcmd", "encrypt&send: %s\n", cmd.c_str());
+                    sendStatus = DBB::sendEncryptedCommand(cmd, *key, cmdOut, timeoutMS, token);
+                    if (sendStatus != DBB::DBB_COMMAND_STATUS_OK)
+                        DebugOut("sendcmd", "sending command failed\n");
+                    else
+                        DBB::decryptAndDecodeCommand(cmdOut, *key, response);
                 }
-                else
-                {
-                    DebugOut("sendcmd", "send unencrypted: %s\n", cmd.c_str());
-                    DBB::sendCommand(cmd, cmdOut);
+                catch (const std::exception& ex) {
+                    DebugOut("sendcmd", "response decryption failed: %s\n", cmdOut.c_str());
+                    response.read(cmdOut);
+                    status = DBB_CMD_EXECUTION_STATUS_ENCRYPTION_FAILED;
                 }
-                std::get<2>(cmdCB)(cmdOut, status);
-                cmdQueue.pop();
             }
-            notified = false;
+            else
+            {
+                DebugOut("sendcmd", "send unencrypted: %s\n", cmd.c_str());
+                sendStatus = DBB::sendCommand(cmd, cmdOut, timeoutMS, token);
+                response.read(cmdOut);
+            }
+
+            if (sendStatus == DBB::DBB_COMMAND_STATUS_TIMEOUT)
+                status = DBB_CMD_EXECUTION_STATUS_TIMEOUT;
+            else if (sendStatus == DBB::DBB_COMMAND_STATUS_CANCELED)
+                status = DBB_CMD_EXECUTION_STATUS_CANCELED;
+            else if (sendStatus != DBB::DBB_COMMAND_STATUS_OK)
+                status = DBB_CMD_EXECUTION_STATUS_DEVICE_ERROR;
+
+            std::get<2>(cmdCB)(response, status);
         }
     });
 
-    //create a thread for the http handling
+    //usb hotplug events (udev) wake up the device check, if they are
+    //not available on this platform, the check falls back to polling
+    std::mutex cs_usb;
+    std::condition_variable usbCondVar;
+    bool usbStateChanged = true;
+    DBB::HotplugMonitor hotplugMonitor;
+    bool hotplugAvailable = hotplugMonitor.start([&](bool attached, const std::string& path) {
+        DebugOut("usb", "device %s: %s\n", attached ? "attached" : "detached", path.c_str());
+        if (!attached)
+            DBB::deviceDetached(path);
+        std::unique_lock<std::mutex> lock(cs_usb);
+        usbStateChanged = true;
+        usbCondVar.notify_one();
+    });
+
+    //create a thread for the usb device check
     std::thread usbCheckThread([&]() {
         while(1)
         {
-            //check devices
-            if (!DBB::isConnectionOpen())
+            {
+                std::unique_lock<std::mutex> lock(cs_usb);
+                if (hotplugAvailable)
+                    usbCondVar.wait(lock, [&]() { return usbStateChanged; });
+                else
+                    usbCondVar.wait_for(lock, std::chrono::milliseconds(1000), [&]() { return usbStateChanged; });
+                usbStateChanged = false;
+            }
+
+            //check devices, without hotplug events a detached device
+            //can only be detected over an enumeration
+            bool connectionOpen = hotplugAvailable ? DBB::isConnectionOpen() : DBB::verifyConnection();
+            if (!connectionOpen)
             {
                 if (DBB::openConnection())
                 {
@@ -206,7 +239,6 @@ int main(int argc, char** argv)
 #endif
                 }
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(1000));
         }
     });
 
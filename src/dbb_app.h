@@ -9,10 +9,27 @@
 #include "config/_dbb-config.h"
 #endif
 
+#include <functional>
+#include <string>
+
+#include "dbb.h"
+
+//deadlines for device commands, touchbutton commands wait for the user
+#define DBB_APP_COMMAND_TIMEOUT_MS 15000
+#define DBB_APP_TOUCHBUTTON_COMMAND_TIMEOUT_MS 60000
+
 typedef enum DBB_CMD_EXECUTION_STATUS
 {
     DBB_CMD_EXECUTION_STATUS_OK,
-    DBB_CMD_EXECUTION_STATUS_ENCRYPTION_FAILED
+    DBB_CMD_EXECUTION_STATUS_ENCRYPTION_FAILED,
+    DBB_CMD_EXECUTION_STATUS_TIMEOUT,
+    DBB_CMD_EXECUTION_STATUS_CANCELED,
+    DBB_CMD_EXECUTION_STATUS_DEVICE_ERROR //!< no device, an I/O error or a command too large to send
 } dbb_cmd_execution_status_t;
 
+//!add a command to the device queue, cmdFinished is called from the queue thread
+// with the parsed (and decrypted) response, the queued command is kept in the LockedPool
+// the command is aborted after timeoutMS or if the returned token gets canceled
+DBB::CancellationTokenRef executeCommand(const DBB::SecureString& cmd, const DBB::SessionKeyRef& key, std::function<void(const UniValue&, dbb_cmd_execution_status_t status)> cmdFinished, int timeoutMS = DBB_APP_COMMAND_TIMEOUT_MS);
+
 #endif
\ No newline at end of file
@@ -36,6 +36,7 @@
 
 #include "dbb.h"
 #include "dbb_util.h"
+#include "libdbb/transport.h"
 
 #include "univalue.h"
 #include "hidapi/hidapi.h"
@@ -163,6 +164,18 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    //stream commands larger than one HID report (requires firmware support)
+    if (DBB::mapArgs.count("-chunked"))
+        DBB::setChunkedTransfer(true);
+
+    //play back a capture instead of talking to a device
+    if (DBB::mapArgs.count("-replay"))
+        DBB::setTransport(std::unique_ptr<DBB::Transport>(new DBB::ReplayTransport(DBB::GetArg("-replay", ""), atof(DBB::GetArg("-replayspeed", "1").c_str()))));
+
+    //record all reports of this session
+    if (DBB::mapArgs.count("-capture") && !DBB::startCapture(DBB::GetArg("-capture", "")))
+        printf("Error: Could not create capture file\n");
+
     if (!DBB::openConnection())
         printf("Error: No digital bitbox connected\n");
 
@@ -237,19 +250,21 @@ int main(int argc, char* argv[])
                         DebugOut("main", "Using encyption because -password was set\n");
                     }
 
-                    std::string password = DBB::GetArg("-password", "0000"); //0000 will never be used because setting a password is required
-                    std::string base64str;
+                    DBB::SessionKey key(DBB::GetArg("-password", "0000")); //0000 will never be used because setting a password is required
                     std::string unencryptedJson;
 
                     DebugOut("main", "encrypting raw json: %s\n", json.c_str());
-                    DBB::encryptAndEncodeCommand(json, password, base64str);
-                    DBB::sendCommand(base64str, cmdOut);
+                    if (DBB::sendEncryptedCommand(json, key, cmdOut) != DBB::DBB_COMMAND_STATUS_OK) {
+                        printf("Error: Sending the command failed\n");
+                        exit(0);
+                    }
                     try {
                         //hack: decryption needs the new password in case the AES256CBC password has changed
-                        if (DBB::mapArgs.count("-newpassword"))
-                            password = DBB::GetArg("-newpassword", "");
-
-                        DBB::decryptAndDecodeCommand(cmdOut, password, unencryptedJson);
+                        if (DBB::mapArgs.count("-newpassword")) {
+                            DBB::SessionKey newKey(DBB::GetArg("-newpassword", ""));
+                            DBB::decryptAndDecodeCommand(cmdOut, newKey, unencryptedJson);
+                        } else
+                            DBB::decryptAndDecodeCommand(cmdOut, key, unencryptedJson);
                     } catch (const std::exception& ex) {
                         printf("%s\n", ex.what());
                         exit(0);
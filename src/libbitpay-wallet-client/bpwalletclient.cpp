@@ -12,7 +12,6 @@
 #include <string.h>
 
 #include "base58.h"
-#include "core_io.h"
 #include "eccryptoverify.h"
 #include "keystore.h"
 #include "serialize.h"
@@ -20,16 +19,20 @@
 #include "pubkey.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "version.h"
 
 #include "libdbb/crypto.h"
 #include "dbb_util.h"
 
 #include <boost/filesystem.hpp>
 
+#include <thread>
+
 //ignore osx depracation warning
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
 
 #include <climits>
+#include <stdlib.h>
 
 std::string BitPayWalletClient::ReversePairs(std::string const& src)
 {
@@ -96,7 +99,8 @@ bool BitPayWalletClient::GetCopayerHash(const std::string& name, std::string& ou
 
 bool BitPayWalletClient::GetCopayerSignature(const std::string& stringToHash, const CKey& privKey, std::string& sigHexOut)
 {
-    uint256 hash = Hash(stringToHash.begin(), stringToHash.end());
+    uint256 hash;
+    doubleSha256((const unsigned char*)stringToHash.data(), stringToHash.size(), hash.begin());
     std::vector<unsigned char> signature;
     privKey.Sign(hash, signature);
 
@@ -193,11 +197,17 @@ bool BitPayWalletClient::GetRequestPubKey(std::string& pubKeyOut)
 
 std::string BitPayWalletClient::GetCopayerId()
 {
+    //the base58 encoding dominates, only recompute if the master key changed
+    if (!copayerIdCache.empty() && copayerIdPubKey == masterPubKey)
+        return copayerIdCache;
+
     CBitcoinExtPubKey base58(masterPubKey);
     std::string output = base58.ToString();
-    unsigned char rkey[32];
-    CSHA256().Write((const unsigned char*)output.c_str(), output.size()).Finalize(rkey);
-    return HexStr(rkey, rkey + DBB_SHA256_DIGEST_LENGTH);
+    unsigned char rkey[DBB_SHA256_DIGEST_LENGTH];
+    sha256((const unsigned char*)output.data(), output.size(), rkey);
+    copayerIdPubKey = masterPubKey;
+    copayerIdCache = HexStr(rkey, rkey + DBB_SHA256_DIGEST_LENGTH);
+    return copayerIdCache;
 }
 
 bool BitPayWalletClient::ParseWalletInvitation(const std::string& walletInvitation, BitpayWalletInvitation& invitationOut)
@@ -252,9 +262,9 @@ bool BitPayWalletClient::JoinWallet(const std::string& name, const std::string&
     jsonArgs.push_back(Pair("walletId", invitation.walletID));
     jsonArgs.push_back(Pair("name", name));
     jsonArgs.push_back(Pair("xPubKey", GetXPubKey()));
-    jsonArgs.push_back(Pair("requestPubKey", requestPubKey));
+    jsonArgs.push_back(Pair("requestPubKey", std::move(requestPubKey)));
     jsonArgs.push_back(Pair("isTemporaryRequestKey", false));
-    jsonArgs.push_back(Pair("copayerSignature", copayerSignature));
+    jsonArgs.push_back(Pair("copayerSignature", std::move(copayerSignature)));
     std::string json = jsonArgs.write();
 
     long httpStatusCode = 0;
@@ -285,80 +295,196 @@ bool BitPayWalletClient::GetWallets(std::string& response)
     return true;
 }
 
+//streams over a wallet status response, picks the copayer index of a given xpub
+//(wallet.copayers[].addressManager.copayerIndex) and builds the pendingTxps array
+//only, the rest of the document is skipped
+class WalletStatusHandler : public UniValueEventHandler
+{
+public:
+    WalletStatusHandler(const std::string& xPubKeyIn, UniValue& pendingTxpsOut) : xPubKey(xPubKeyIn), pendingTxpsBuilder(pendingTxpsOut), forwarding(false), currentCopayerIndex(INT_MAX), copayerIndex(INT_MAX) {}
+
+    bool startObject()
+    {
+        if (forwarding)
+            return pendingTxpsBuilder.startObject();
+        if (InCopayers(3)) {
+            currentXPubKey.clear();
+            currentCopayerIndex = INT_MAX;
+        }
+        return open('{');
+    }
+
+    bool endObject()
+    {
+        if (forwarding)
+            return pendingTxpsBuilder.endObject();
+        if (InCopayers(4) && currentXPubKey == xPubKey && currentCopayerIndex != INT_MAX)
+            copayerIndex = currentCopayerIndex;
+        return close();
+    }
+
+    bool startArray()
+    {
+        if (forwarding)
+            return pendingTxpsBuilder.startArray();
+        if (path.empty())
+            return false; //the response needs to be an object
+        if (path.size() == 1 && currentKey == "pendingTxps") {
+            forwarding = true;
+            return pendingTxpsBuilder.startArray();
+        }
+        return open('[');
+    }
+
+    bool endArray()
+    {
+        if (forwarding) {
+            if (!pendingTxpsBuilder.endArray())
+                return false;
+            forwarding = !pendingTxpsBuilder.complete();
+            return true;
+        }
+        return close();
+    }
+
+    bool key(const std::string& name)
+    {
+        if (forwarding)
+            return pendingTxpsBuilder.key(name);
+        currentKey = name;
+        return true;
+    }
+
+    bool str(const std::string& val)
+    {
+        if (forwarding)
+            return pendingTxpsBuilder.str(val);
+        if (InCopayers(4) && currentKey == "xPubKey")
+            currentXPubKey = val;
+        return true;
+    }
+
+    bool num(const std::string& val)
+    {
+        if (forwarding)
+            return pendingTxpsBuilder.num(val);
+        if (InCopayers(5) && path[4] == "addressManager" && currentKey == "copayerIndex")
+            currentCopayerIndex = atoi(val.c_str());
+        return true;
+    }
+
+    bool boolean(bool val) { return forwarding ? pendingTxpsBuilder.boolean(val) : true; }
+    bool null() { return forwarding ? pendingTxpsBuilder.null() : true; }
+
+    int CopayerIndex() const { return copayerIndex; }
+
+private:
+    std::string xPubKey;
+    UniValueBuilder pendingTxpsBuilder;
+    bool forwarding; //!< inside pendingTxps, events go to the builder
+
+    std::vector<std::string> path; //!< keys of the open containers ("" for the root and array elements)
+    std::string containers;        //!< types ('{' or '[') of the open containers
+    std::string currentKey;
+
+    std::string currentXPubKey;
+    int currentCopayerIndex;
+    int copayerIndex;
+
+    //true if depth containers are open and the outer three are the root, wallet and wallet.copayers
+    bool InCopayers(size_t depth) const
+    {
+        return path.size() == depth && depth >= 3 && path[1] == "wallet" && path[2] == "copayers" && containers[2] == '[';
+    }
+
+    bool open(char type)
+    {
+        path.push_back((!containers.empty() && containers.back() == '{') ? currentKey : std::string());
+        containers.push_back(type);
+        return true;
+    }
+
+    bool close()
+    {
+        path.pop_back();
+        containers.pop_back();
+        return true;
+    }
+};
+
+bool BitPayWalletClient::ParseWalletStatus(const std::string& walletStatus, int& copayerIndexOut, UniValue& pendingTxpsOut)
+{
+    pendingTxpsOut.clear();
+
+    WalletStatusHandler handler(GetXPubKey(), pendingTxpsOut);
+    if (!readJsonEvents(walletStatus.data(), walletStatus.size(), handler))
+        return false;
+
+    copayerIndexOut = handler.CopayerIndex();
+    return true;
+}
+
 std::string BitPayWalletClient::ParseTxProposal(const UniValue& txProposal, std::vector<std::pair<std::string, uint256> >& vInputTxHashes)
 {
     CMutableTransaction t;
-    std::vector<std::string> keys = txProposal.getKeys();
-    std::vector<UniValue> values = txProposal.getValues();
 
     std::string toAddress;
     CAmount toAmount = -1;
     CAmount fee = -1;
     std::vector<int> outputOrder;
     int requiredSignatures = -1;
-    int i = 0;
-    int j = 0;
-    for (i = 0; i < keys.size(); i++) {
-        UniValue val = values[i];
+    for (UniValue::KeyValue kv : txProposal.getKeyValues()) {
+        const UniValue& val = kv.second;
 
-        if (keys[i] == "toAddress")
+        if (kv.first == "toAddress")
             toAddress = val.get_str();
 
-        if (keys[i] == "amount")
+        if (kv.first == "amount")
             toAmount = val.get_int64();
 
-        if (keys[i] == "fee")
+        if (kv.first == "fee")
             fee = val.get_int64();
 
-        if (keys[i] == "outputOrder")
-            for (UniValue aVal : val.getValues())
+        if (kv.first == "outputOrder")
+            for (const UniValue& aVal : val.getValues())
                 outputOrder.push_back(aVal.get_int());
 
-        if (keys[i] == "requiredSignatures")
+        if (kv.first == "requiredSignatures")
             requiredSignatures = val.get_int();
     }
 
-    UniValue inputsObj = find_value(txProposal, "inputs");
-    std::vector<UniValue> inputs = inputsObj.getValues();
+    const UniValue& inputsObj = find_value(txProposal, "inputs");
     CAmount inTotal = 0;
 
     CScript checkScript;
     std::vector<std::pair<std::string, CScript> > inputsScriptAndPath;
-    for (i = 0; i < inputs.size(); i++) {
-        UniValue aInput = inputs[i];
-        std::vector<std::string> keys = aInput.getKeys();
-        std::vector<UniValue> values = aInput.getValues();
-
+    for (const UniValue& aInput : inputsObj.getValues()) {
         std::string txId;
         std::vector<CPubKey> publicKeys;
         std::string path;
         CScript script;
         int nInput = -1;
 
-        for (j = 0; j < keys.size(); j++) {
-            UniValue val = values[j];
-            if (keys[j] == "txid")
+        for (UniValue::KeyValue kv : aInput.getKeyValues()) {
+            const UniValue& val = kv.second;
+            if (kv.first == "txid")
                 txId = val.get_str();
 
-            if (keys[j] == "vout")
+            if (kv.first == "vout")
                 nInput = val.get_int();
 
-            if (keys[j] == "satoshis")
+            if (kv.first == "satoshis")
                 inTotal = val.get_int();
 
-            if (keys[j] == "path")
+            if (kv.first == "path")
                 path = val.get_str();
 
-            if (keys[j] == "publicKeys") {
-                std::vector<UniValue> pubKeyValue = val.getValues();
+            if (kv.first == "publicKeys") {
                 std::vector<std::string> keys;
-                int k;
-                for (k = 0; k < pubKeyValue.size(); k++) {
-                    UniValue aPubKeyObj = pubKeyValue[k];
+                for (const UniValue& aPubKeyObj : val.getValues())
                     keys.push_back(aPubKeyObj.get_str());
-                }
                 std::sort(keys.begin(), keys.end());
-                for (k = 0; k < keys.size(); k++) {
+                for (size_t k = 0; k < keys.size(); k++) {
                     CPubKey vchPubKey(ParseHex(keys[k]));
                     publicKeys.push_back(vchPubKey);
                 }
@@ -370,19 +496,16 @@ std::string BitPayWalletClient::ParseTxProposal(const UniValue& txProposal, std:
         script += GetScriptForMultisig(requiredSignatures, publicKeys);
 
         path.erase(0, 2); //remove m/ from path
-        inputsScriptAndPath.push_back(std::make_pair(path, GetScriptForMultisig(requiredSignatures, publicKeys)));
+        //kept in the (reversed) order of the transaction inputs
+        inputsScriptAndPath.insert(inputsScriptAndPath.begin(), std::make_pair(path, GetScriptForMultisig(requiredSignatures, publicKeys)));
         t.vin.insert(t.vin.begin(), CTxIn(aHash, nInput, script));
     }
 
-    UniValue changeAddrObj = find_value(txProposal, "changeAddress");
-    keys = changeAddrObj.getKeys();
-    values = changeAddrObj.getValues();
+    const UniValue& changeAddrObj = find_value(txProposal, "changeAddress");
     std::string changeAdr = "";
-    for (i = 0; i < keys.size(); i++) {
-        UniValue val = values[i];
-
-        if (keys[i] == "address")
-            changeAdr = val.get_str();
+    for (UniValue::KeyValue kv : changeAddrObj.getKeyValues()) {
+        if (kv.first == "address")
+            changeAdr = kv.second.get_str();
     }
 
 
@@ -403,18 +526,74 @@ std::string BitPayWalletClient::ParseTxProposal(const UniValue& txProposal, std:
 
     int cnt = 0;
     for (const CTxIn& txIn : t.vin) {
-        std::pair<std::string, CScript> scriptAndPath = inputsScriptAndPath[cnt];
-        CScript aScript = scriptAndPath.second;
-        uint256 hash = SignatureHash(aScript, t, 0, SIGHASH_ALL);
+        const std::pair<std::string, CScript>& scriptAndPath = inputsScriptAndPath[cnt];
+        uint256 hash = SignatureHash(scriptAndPath.second, t, cnt, SIGHASH_ALL);
         vInputTxHashes.push_back(std::make_pair(scriptAndPath.first, hash));
         cnt++;
     }
-    std::string hex = EncodeHexTx(t);
+    //serialized here instead of over EncodeHexTx(), core_write.o is built
+    //against the vendored UniValue and must not get linked (see Makefile.am)
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << t;
+    std::string hex = HexStr(ssTx.begin(), ssTx.end());
     SelectParams(CBaseChainParams::TESTNET);
 
     return hex;
 }
 
+//verifying a signature takes a few 10us, don't start a thread for less
+static const size_t nMinSigsPerVerifyThread = 4;
+
+static bool VerifyCompactSignature(const uint256& hash, const std::string& sigHex, const std::string& pubKeyHex)
+{
+    std::vector<unsigned char> sigData = ParseHex(sigHex);
+    if (sigData.size() != 64)
+        return false;
+
+    //the signature gets posted as it is, a high-S one would not be relayed
+    if (!eccrypto::CheckSignatureElement(&sigData[0], 32, false) || !eccrypto::CheckSignatureElement(&sigData[32], 32, true))
+        return false;
+
+    CPubKey pubKey(ParseHex(pubKeyHex));
+    if (!pubKey.IsValid())
+        return false;
+
+    unsigned char der[74];
+    int derLen = ecdsa_sig_to_der(&sigData[0], der);
+    return pubKey.Verify(hash, std::vector<unsigned char>(der, der + derLen));
+}
+
+bool BitPayWalletClient::VerifyInputSignatures(const std::vector<std::pair<std::string, uint256> >& vInputTxHashes, const std::vector<std::string>& vHexSigs, const std::vector<std::string>& vHexPubKeys, std::vector<bool>& validOut)
+{
+    size_t nSigs = vInputTxHashes.size();
+    validOut.assign(nSigs, false);
+    if (vHexSigs.size() != nSigs || vHexPubKeys.size() != nSigs)
+        return false;
+    if (nSigs == 0)
+        return true;
+
+    std::vector<char> valid(nSigs, 0); //not a vector<bool>, threads write to neighbouring elements
+    auto verifyStride = [&](size_t first, size_t stride) {
+        for (size_t i = first; i < nSigs; i += stride)
+            valid[i] = VerifyCompactSignature(vInputTxHashes[i].second, vHexSigs[i], vHexPubKeys[i]);
+    };
+
+    size_t nThreads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), (nSigs + nMinSigsPerVerifyThread - 1) / nMinSigsPerVerifyThread);
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < nThreads; i++)
+        threads.push_back(std::thread(verifyStride, i, nThreads));
+    verifyStride(0, nThreads);
+    for (std::thread& thread : threads)
+        thread.join();
+
+    bool allValid = true;
+    for (size_t i = 0; i < nSigs; i++) {
+        validOut[i] = valid[i];
+        allValid = allValid && valid[i];
+    }
+    return allValid;
+}
+
 int ecdsa_sig_to_der(const uint8_t* sig, uint8_t* der)
 {
     int i;
@@ -489,10 +668,9 @@ bool BitPayWalletClient::PostSignaturesForTxProposal(const UniValue& txProposal,
         std::vector<unsigned char> data = ParseHex(sSig);
         unsigned char sig[74];
         int sizeN = ecdsa_sig_to_der(&data[0], sig);
-        std::string sSigDER = HexStr(sig, sig + sizeN);
-        sigs.push_back(sSigDER);
+        sigs.emplace_back(UniValue::VSTR, HexStr(sig, sig + sizeN));
     }
-    signaturesRequest.push_back(Pair("signatures", sigs));
+    signaturesRequest.pushKV("signatures", std::move(sigs));
     std::string response;
     long httpStatusCode = 0;
     SendRequest("post", "/v1/txproposals/" + txpID + "/signatures/", signaturesRequest.write(), response, httpStatusCode);
@@ -529,7 +707,8 @@ std::string BitPayWalletClient::SignRequest(const std::string& method,
                                             const std::string& args)
 {
     std::string message = method + "|" + url + "|" + args;
-    uint256 hash = Hash(message.begin(), message.end());
+    uint256 hash;
+    doubleSha256((const unsigned char*)message.data(), message.size(), hash.begin());
     std::vector<unsigned char> signature;
     printf("signing message: %s\n", message.c_str());
     requestKey.Sign(hash, signature);
@@ -49,7 +49,7 @@
 #include "pubkey.h"
 #include "key.h"
 #include "random.h"
-#include "univalue/univalue.h"
+#include "univalue.h"
 
 
 class BitpayWalletInvitation
@@ -90,9 +90,19 @@ public:
     //!load available wallets over wallet server
     bool GetWallets(std::string& response);
 
+    //!extracts the pending transaction proposals and the copayer index of our xpub (INT_MAX if not found)
+    // out of a wallet status response (see GetWallets), only the pendingTxps array gets materialized
+    bool ParseWalletStatus(const std::string& walletStatus, int& copayerIndexOut, UniValue& pendingTxpsOut);
+
     //!parse a transaction proposal, export inputs keypath/hashes ready for signing
     std::string ParseTxProposal(const UniValue& txProposal, std::vector<std::pair<std::string, uint256> >& vInputTxHashes);
 
+    //!verify the signatures (compact R|S, hex) the device returned for the input hashes against
+    // the public keys (hex) of the signing keys, runs in parallel for larger proposals
+    // high-S signatures are rejected, they are posted to the wallet server unchanged
+    // returns true if all signatures are valid, validOut flags every single signature
+    static bool VerifyInputSignatures(const std::vector<std::pair<std::string, uint256> >& vInputTxHashes, const std::vector<std::string>& vHexSigs, const std::vector<std::string>& vHexPubKeys, std::vector<bool>& validOut);
+
     //!post signatures for a transaction proposal to the wallet server
     bool PostSignaturesForTxProposal(const UniValue& txProposal, const std::vector<std::string>& vHexSigs);
 
@@ -141,7 +151,14 @@ private:
 
     std::string baseURL; //!< base URL for the wallet server
 
+    CExtPubKey copayerIdPubKey; //!< master key the cached copayer id belongs to
+    std::string copayerIdCache;
+
     std::vector<std::string> split(const std::string& str, std::vector<int> indexes);
     std::string _copayerHash(const std::string& name, const std::string& xPubKey, const std::string& requestPubKey);
 };
+
+//!converts a compact 64 byte signature (R|S) to DER, der needs room for 72 bytes
+// returns the length of the DER signature
+int ecdsa_sig_to_der(const uint8_t* sig, uint8_t* der);
 #endif //BP_WALLET_CLIENT_H
\ No newline at end of file
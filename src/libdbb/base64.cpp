@@ -3,100 +3,362 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <stdio.h>
+#include <string.h>
 #include <string>
 
-static const std::string base64_chars =
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DBB_BASE64_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+static const char base64_chars[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
     "abcdefghijklmnopqrstuvwxyz"
     "0123456789+/";
 
+#define B64_INVALID 0xff
+
+//maps a char to its 6 bit value, B64_INVALID for padding and non base64 chars
+static const unsigned char base64_values[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 62,   0xff, 0xff, 0xff, 63,
+    52,   53,   54,   55,   56,   57,   58,   59,   60,   61,   0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0,    1,    2,    3,    4,    5,    6,    7,    8,    9,    10,   11,   12,   13,   14,
+    15,   16,   17,   18,   19,   20,   21,   22,   23,   24,   25,   0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 26,   27,   28,   29,   30,   31,   32,   33,   34,   35,   36,   37,   38,   39,   40,
+    41,   42,   43,   44,   45,   46,   47,   48,   49,   50,   51,   0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+//the vector paths process whole blocks and return the amount of input
+//consumed, the scalar code handles the remaining tail
+typedef size_t (*base64_block_fn)(const unsigned char* in, size_t in_len, unsigned char* out);
 
-static inline bool is_base64(unsigned char c)
+static size_t base64_encode_blocks_none(const unsigned char*, size_t, unsigned char*)
 {
-    return (isalnum(c) || (c == '+') || (c == '/'));
+    return 0;
 }
 
-std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len)
+static size_t base64_decode_blocks_none(const unsigned char*, size_t, unsigned char*)
 {
-    std::string ret;
-    int i = 0;
-    int j = 0;
-    unsigned char char_array_3[3];
-    unsigned char char_array_4[4];
+    return 0;
+}
 
-    while (in_len--) {
-        char_array_3[i++] = *(bytes_to_encode++);
-        if (i == 3) {
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
+#ifdef DBB_BASE64_X86_SIMD
+//encode: 12 input bytes are spread over 16 lanes and split into 6 bit
+//indices, the indices are mapped to ascii by adding a per range offset
+//decode: the reverse, a block containing padding or any non base64 char is
+//left to the scalar code which stops at the right place
+//(see Wojciech Mula, Daniel Lemire, "Faster Base64 Encoding and Decoding")
 
-            for (i = 0; (i < 4); i++)
-                ret += base64_chars[char_array_4[i]];
-            i = 0;
-        }
+__attribute__((target("ssse3"))) static inline __m128i base64_enc_reshuffle(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+__attribute__((target("ssse3"))) static inline __m128i base64_enc_translate(__m128i indices)
+{
+    const __m128i shift_lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                            '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+    return _mm_add_epi8(_mm_shuffle_epi8(shift_lut, result), indices);
+}
+
+__attribute__((target("ssse3"))) static size_t base64_encode_blocks_ssse3(const unsigned char* in, size_t in_len, unsigned char* out)
+{
+    size_t done = 0;
+    //a block loads 16 bytes but consumes 12
+    for (; in_len - done >= 16; done += 12, out += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(in + done));
+        _mm_storeu_si128((__m128i*)out, base64_enc_translate(base64_enc_reshuffle(block)));
     }
+    return done;
+}
+
+__attribute__((target("ssse3"))) static inline bool base64_dec_block(__m128i& block)
+{
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                           0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nibble_mask = _mm_set1_epi8(0x0f);
+
+    const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(block, 4), nibble_mask);
+    const __m128i lo_nibbles = _mm_and_si128(block, nibble_mask);
+    const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    const __m128i invalid = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+    if (_mm_movemask_epi8(invalid) != 0xffff)
+        return false;
+
+    const __m128i eq_2f = _mm_cmpeq_epi8(block, _mm_set1_epi8('/'));
+    const __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+    block = _mm_add_epi8(block, roll);
 
-    if (i) {
-        for (j = i; j < 3; j++)
-            char_array_3[j] = '\0';
+    //merge 4x6 bits into 3 bytes per 32 bit lane
+    const __m128i merged = _mm_maddubs_epi16(block, _mm_set1_epi32(0x01400140));
+    block = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    block = _mm_shuffle_epi8(block, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    return true;
+}
+
+__attribute__((target("ssse3"))) static size_t base64_decode_blocks_ssse3(const unsigned char* in, size_t in_len, unsigned char* out)
+{
+    size_t done = 0;
+    //a block stores 16 bytes but produces 12, keep enough input left to
+    //stay within base64_decoded_size_max()
+    for (; in_len - done >= 24; done += 16, out += 12) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(in + done));
+        if (!base64_dec_block(block))
+            break;
+        _mm_storeu_si128((__m128i*)out, block);
+    }
+    return done;
+}
 
-        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-        char_array_4[3] = char_array_3[2] & 0x3f;
+__attribute__((target("avx2"))) static size_t base64_encode_blocks_avx2(const unsigned char* in, size_t in_len, unsigned char* out)
+{
+    const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i shift_lut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                               '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                               'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                               '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t done = 0;
+    //two 12 byte blocks per iteration, the upper one is loaded from +12
+    for (; in_len - done >= 28; done += 24, out += 32) {
+        const __m128i lo = _mm_loadu_si128((const __m128i*)(in + done));
+        const __m128i hi = _mm_loadu_si128((const __m128i*)(in + done + 12));
+        __m256i block = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
 
-        for (j = 0; (j < i + 1); j++)
-            ret += base64_chars[char_array_4[j]];
+        block = _mm256_shuffle_epi8(block, shuffle);
+        const __m256i t0 = _mm256_and_si256(block, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(block, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(t1, t3);
 
-        while ((i++ < 3))
-            ret += '=';
+        __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        result = _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, result), indices);
+        _mm256_storeu_si256((__m256i*)out, result);
     }
+    return done + base64_encode_blocks_ssse3(in + done, in_len - done, out);
+}
 
-    return ret;
+__attribute__((target("avx2"))) static size_t base64_decode_blocks_avx2(const unsigned char* in, size_t in_len, unsigned char* out)
+{
+    const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                              0, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 16, 19, 4, -65, -65, -71, -71,
+                                              0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+
+    size_t done = 0;
+    //a block stores 32 bytes but produces 24
+    for (; in_len - done >= 48; done += 32, out += 24) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(in + done));
+
+        const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(block, 4), nibble_mask);
+        const __m256i lo_nibbles = _mm256_and_si256(block, nibble_mask);
+        const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+        const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        if (!_mm256_testz_si256(lo, hi))
+            break;
+
+        const __m256i eq_2f = _mm256_cmpeq_epi8(block, _mm256_set1_epi8('/'));
+        const __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+        block = _mm256_add_epi8(block, roll);
+
+        const __m256i merged = _mm256_maddubs_epi16(block, _mm256_set1_epi32(0x01400140));
+        block = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        block = _mm256_shuffle_epi8(block, pack);
+        //move the 12 bytes of the upper lane next to the ones of the lower lane
+        block = _mm256_permutevar8x32_epi32(block, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256((__m256i*)out, block);
+    }
+    return done + base64_decode_blocks_ssse3(in + done, in_len - done, out);
 }
 
-std::string base64_decode(std::string const& encoded_string)
+static bool base64_cpu_supports(const char* name)
 {
-    int in_len = encoded_string.size();
-    int i = 0;
-    int j = 0;
-    int in_ = 0;
-    unsigned char char_array_4[4], char_array_3[3];
-    std::string ret;
+    __builtin_cpu_init();
+    if (strcmp(name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+    if (strcmp(name, "ssse3") == 0)
+        return __builtin_cpu_supports("ssse3");
+    return false;
+}
+#endif
 
-    while (in_len-- && (encoded_string[in_] != '=') && is_base64(encoded_string[in_])) {
-        char_array_4[i++] = encoded_string[in_];
-        in_++;
-        if (i == 4) {
-            for (i = 0; i < 4; i++)
-                char_array_4[i] = base64_chars.find(char_array_4[i]);
+//the block functions in use, the fastest ones of the CPU unless overridden
+class Base64Dispatch
+{
+public:
+    base64_block_fn encode;
+    base64_block_fn decode;
+    const char* name;
 
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+    Base64Dispatch() : encode(base64_encode_blocks_none), decode(base64_decode_blocks_none), name("generic")
+    {
+        if (!select("avx2"))
+            select("ssse3");
+    }
 
-            for (i = 0; (i < 3); i++)
-                ret += char_array_3[i];
-            i = 0;
+    bool select(const char* nameIn)
+    {
+        if (strcmp(nameIn, "generic") == 0) {
+            encode = base64_encode_blocks_none;
+            decode = base64_decode_blocks_none;
+            name = "generic";
+            return true;
         }
+#ifdef DBB_BASE64_X86_SIMD
+        if (!base64_cpu_supports(nameIn))
+            return false;
+        if (strcmp(nameIn, "avx2") == 0) {
+            encode = base64_encode_blocks_avx2;
+            decode = base64_decode_blocks_avx2;
+            name = "avx2";
+            return true;
+        }
+        if (strcmp(nameIn, "ssse3") == 0) {
+            encode = base64_encode_blocks_ssse3;
+            decode = base64_decode_blocks_ssse3;
+            name = "ssse3";
+            return true;
+        }
+#endif
+        return false;
     }
+};
+
+static Base64Dispatch& base64_dispatch()
+{
+    static Base64Dispatch dispatch;
+    return dispatch;
+}
+
+const char* base64_implementation()
+{
+    return base64_dispatch().name;
+}
+
+bool base64_select_implementation(const char* name)
+{
+    return base64_dispatch().select(name);
+}
 
-    if (i) {
-        for (j = i; j < 4; j++)
-            char_array_4[j] = 0;
+size_t base64_encoded_size(size_t in_len)
+{
+    return (in_len + 2) / 3 * 4;
+}
+
+size_t base64_encode(const unsigned char* bytes_to_encode, size_t in_len, char* out)
+{
+    size_t done = base64_dispatch().encode(bytes_to_encode, in_len, (unsigned char*)out);
+    char* pos = out + done / 3 * 4;
+    bytes_to_encode += done;
+    in_len -= done;
 
-        for (j = 0; j < 4; j++)
-            char_array_4[j] = base64_chars.find(char_array_4[j]);
+    for (; in_len >= 3; in_len -= 3, bytes_to_encode += 3) {
+        *pos++ = base64_chars[(bytes_to_encode[0] & 0xfc) >> 2];
+        *pos++ = base64_chars[((bytes_to_encode[0] & 0x03) << 4) + ((bytes_to_encode[1] & 0xf0) >> 4)];
+        *pos++ = base64_chars[((bytes_to_encode[1] & 0x0f) << 2) + ((bytes_to_encode[2] & 0xc0) >> 6)];
+        *pos++ = base64_chars[bytes_to_encode[2] & 0x3f];
+    }
 
-        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-        char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+    if (in_len) {
+        unsigned char char_array_3[3] = {0, 0, 0};
+        for (size_t i = 0; i < in_len; i++)
+            char_array_3[i] = bytes_to_encode[i];
 
-        for (j = 0; (j < i - 1); j++)
-            ret += char_array_3[j];
+        *pos++ = base64_chars[(char_array_3[0] & 0xfc) >> 2];
+        *pos++ = base64_chars[((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4)];
+        *pos++ = (in_len > 1) ? base64_chars[((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6)] : '=';
+        *pos++ = '=';
     }
 
+    return pos - out;
+}
+
+std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len)
+{
+    std::string ret(base64_encoded_size(in_len), '\0');
+    if (!ret.empty())
+        base64_encode(bytes_to_encode, in_len, &ret[0]);
+    return ret;
+}
+
+size_t base64_decoded_size_max(size_t in_len)
+{
+    return (in_len + 3) / 4 * 3;
+}
+
+size_t base64_decode(const char* encoded, size_t in_len, unsigned char* out)
+{
+    const unsigned char* in = (const unsigned char*)encoded;
+    size_t done = base64_dispatch().decode(in, in_len, out);
+    unsigned char* pos = out + done / 4 * 3;
+    const unsigned char* end = in + in_len;
+    in += done;
+
+    //decoding stops at the first padding or non base64 char
+    unsigned char char_array_4[4];
+    size_t i = 0;
+    for (; in < end; in++) {
+        unsigned char value = base64_values[*in];
+        if (value == B64_INVALID)
+            break;
+        char_array_4[i++] = value;
+        if (i == 4) {
+            *pos++ = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
+            *pos++ = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
+            *pos++ = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+            i = 0;
+        }
+    }
+
+    //a trailing group of n chars carries n - 1 bytes
+    if (i > 1)
+        *pos++ = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
+    if (i > 2)
+        *pos++ = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
+
+    return pos - out;
+}
+
+std::string base64_decode(std::string const& encoded_string)
+{
+    std::string ret(base64_decoded_size_max(encoded_string.size()), '\0');
+    if (!ret.empty())
+        ret.resize(base64_decode(encoded_string.data(), encoded_string.size(), (unsigned char*)&ret[0]));
     return ret;
 }
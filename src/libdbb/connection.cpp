@@ -0,0 +1,433 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "connection.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#ifndef _SRC_CONFIG__DBB_CONFIG_H
+#include "config/_dbb-config.h"
+#endif
+
+#ifdef DBB_ENABLE_DEBUG
+#define DBB_DEBUG_INTERNAL(format, args...) printf(format, ##args);
+#else
+#define DBB_DEBUG_INTERNAL(format, args...)
+#endif
+
+#define DBB_CANCEL_POLL_INTERVAL_MS 100
+
+namespace DBB
+{
+//incremental scanner to detect the end of a json response
+class JSONFrameScanner
+{
+public:
+    JSONFrameScanner() : depth(0), inString(false), escaped(false), started(false) {}
+
+    //!scan the next len bytes, returns the position after the closing brace or -1 if the frame is incomplete
+    int scan(const unsigned char* buf, int len)
+    {
+        for (int i = 0; i < len; i++) {
+            unsigned char c = buf[i];
+            if (inString) {
+                if (escaped)
+                    escaped = false;
+                else if (c == '\\')
+                    escaped = true;
+                else if (c == '"')
+                    inString = false;
+            } else if (c == '"')
+                inString = true;
+            else if (c == '{' || c == '[') {
+                depth++;
+                started = true;
+            } else if (c == '}' || c == ']') {
+                depth--;
+                if (started && depth <= 0)
+                    return i + 1;
+            }
+        }
+        return -1;
+    }
+
+private:
+    int depth;
+    bool inString;
+    bool escaped;
+    bool started;
+};
+
+Connection::Connection(std::unique_ptr<Transport> transportIn) : transport(std::move(transportIn)), report(HID_REPORT_SIZE, 0), staleReplies(0), opened(false), deviceLost(false), readMode(DBB_READ_MODE_FRAMED), chunked(false), nCommands(0), nBytesWritten(0), nBytesRead(0), nTimeouts(0), nCancellations(0), nErrors(0)
+{
+    if (!transport)
+        transport.reset(new HIDTransport());
+}
+
+Connection::~Connection()
+{
+    close();
+}
+
+void Connection::setTransport(std::unique_ptr<Transport> transportIn)
+{
+    std::lock_guard<std::mutex> lock(cs_connection);
+    std::lock_guard<std::mutex> transportLock(cs_transport);
+    transport->close();
+    transport = std::move(transportIn);
+    opened = false;
+    staleReplies = 0;
+    deviceLost = false;
+}
+
+bool Connection::startCapture(const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock(cs_connection);
+    CaptureTransport* capture = CaptureTransport::create(transport, filename);
+    if (!capture)
+        return false;
+
+    std::lock_guard<std::mutex> transportLock(cs_transport);
+    transport.reset(capture);
+    return true;
+}
+
+bool Connection::stopCapture()
+{
+    std::lock_guard<std::mutex> lock(cs_connection);
+    CaptureTransport* capture = dynamic_cast<CaptureTransport*>(transport.get());
+    if (!capture)
+        return false;
+
+    std::lock_guard<std::mutex> transportLock(cs_transport);
+    transport = capture->getInner();
+    return true;
+}
+
+bool Connection::open(const std::string& pathIn)
+{
+    std::lock_guard<std::mutex> lock(cs_connection);
+    opened = false;
+
+    //resolve the first device so the liveness can be tied to its path
+    std::string openPath = pathIn;
+    if (openPath.empty()) {
+        std::vector<std::string> paths = transport->enumerate();
+        if (paths.empty())
+            return false;
+        openPath = paths.front();
+    }
+
+    {
+        std::lock_guard<std::mutex> transportLock(cs_transport);
+        //reopening the same device keeps the replies it still owes
+        if (openPath != path || deviceLost)
+            staleReplies = 0;
+        deviceLost = false;
+        path = openPath;
+    }
+    opened = transport->open(openPath);
+    return opened;
+}
+
+bool Connection::close()
+{
+    std::lock_guard<std::mutex> lock(cs_connection);
+    opened = false;
+    return transport->close();
+}
+
+bool Connection::isOpen() const
+{
+    return opened;
+}
+
+bool Connection::verify()
+{
+    if (!opened)
+        return false;
+
+    std::string openPath = getPath();
+    std::vector<std::string> paths = enumerate();
+    if (std::find(paths.begin(), paths.end(), openPath) == paths.end()) {
+        deviceLost = true;
+        opened = false;
+    }
+
+    return opened;
+}
+
+void Connection::deviceDetached(const std::string& detachedPath)
+{
+    if (!opened)
+        return;
+
+    if (detachedPath == getPath()) {
+        deviceLost = true;
+        opened = false;
+    } else
+        verify();
+}
+
+std::vector<std::string> Connection::enumerate()
+{
+    //don't wait for a command in process, enumeration does not touch the device handle
+    std::shared_ptr<Transport> enumerator;
+    {
+        std::lock_guard<std::mutex> lock(cs_transport);
+        enumerator = transport;
+    }
+    return enumerator->enumerate();
+}
+
+std::string Connection::getPath() const
+{
+    std::lock_guard<std::mutex> lock(cs_transport);
+    return path;
+}
+
+void Connection::setReadMode(dbb_read_mode_t mode)
+{
+    readMode = mode;
+}
+
+void Connection::setChunkedTransfer(bool enabled)
+{
+    chunked = enabled;
+}
+
+ConnectionStats Connection::getStats() const
+{
+    ConnectionStats stats;
+    stats.commands = nCommands;
+    stats.bytesWritten = nBytesWritten;
+    stats.bytesRead = nBytesRead;
+    stats.timeouts = nTimeouts;
+    stats.cancellations = nCancellations;
+    stats.errors = nErrors;
+    return stats;
+}
+
+//write the request, split into multiple reports in chunked mode
+// the request may be located in the report buffer itself
+bool Connection::writeRequest(const unsigned char* data, size_t size, bool chunkedMode)
+{
+    size_t pos = 0;
+    size_t len;
+    do {
+        len = size - pos;
+        if (len >= HID_REPORT_SIZE) {
+            //full reports are written directly from the request
+            len = HID_REPORT_SIZE;
+            if (transport->write(data + pos, HID_REPORT_SIZE) < 0)
+                return false;
+        } else {
+            memmove(&report[0], data + pos, len);
+            memset(&report[len], 0, HID_REPORT_SIZE - len);
+            if (transport->write(&report[0], HID_REPORT_SIZE) < 0)
+                return false;
+        }
+        nBytesWritten += HID_REPORT_SIZE;
+        pos += len;
+        //a request filling its last report gets terminated by an empty report
+    } while (pos < size || (chunkedMode && len == HID_REPORT_SIZE));
+
+    return true;
+}
+
+//write the command and read the response, cs_connection must be held
+// timeoutMS < 0 waits forever, the token (optional) is checked every DBB_CANCEL_POLL_INTERVAL_MS
+dbb_command_status_t Connection::exchangeCommand(const unsigned char* request, size_t size, std::string& resultOut, int timeoutMS, const CancellationToken* token)
+{
+    bool chunkedMode = chunked;
+    size_t maxSize = chunkedMode ? DBB_CHUNKED_MAX_SIZE : HID_REPORT_SIZE;
+
+    if (!transport->isOpen())
+        return DBB_COMMAND_STATUS_NO_DEVICE;
+
+    if (size > maxSize)
+        return DBB_COMMAND_STATUS_TOO_LARGE;
+
+    if (token && token->isCanceled())
+        return DBB_COMMAND_STATUS_CANCELED;
+
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMS);
+
+    DBB_DEBUG_INTERNAL("Sending command: %.*s\n", (int)size, (const char*)request);
+
+    if (!writeRequest(request, size, chunkedMode))
+        return DBB_COMMAND_STATUS_IO_ERROR;
+    nCommands++;
+
+    //the device answers in order, replies of aborted commands come first and get dropped
+    dbb_command_status_t status = DBB_COMMAND_STATUS_OK;
+    std::string staleReply;
+    while (staleReplies > 0 && status == DBB_COMMAND_STATUS_OK) {
+        status = readResponse(staleReply, maxSize, chunkedMode, deadline, timeoutMS, token);
+        if (status == DBB_COMMAND_STATUS_OK) {
+            DBB_DEBUG_INTERNAL("Dropped the reply of an aborted command\n");
+            staleReplies--;
+        }
+    }
+    if (status == DBB_COMMAND_STATUS_OK)
+        status = readResponse(resultOut, maxSize, chunkedMode, deadline, timeoutMS, token);
+
+    //the reply to this command is still on its way
+    if (status == DBB_COMMAND_STATUS_TIMEOUT || status == DBB_COMMAND_STATUS_CANCELED)
+        staleReplies++;
+
+    return status;
+}
+
+//read a single response, cs_connection must be held
+dbb_command_status_t Connection::readResponse(std::string& resultOut, size_t maxSize, bool chunkedMode, const std::chrono::steady_clock::time_point& deadline, int timeoutMS, const CancellationToken* token)
+{
+    typedef std::chrono::steady_clock clock;
+    int res;
+    size_t cnt = 0;
+
+    DBB_DEBUG_INTERNAL("try to read some bytes...\n");
+
+    // framed mode stops reading as soon as the json response is complete
+    // instead of waiting for the padding of the full report
+    bool framed = (readMode == DBB_READ_MODE_FRAMED);
+    bool terminated = false;
+    JSONFrameScanner scanner;
+    int frameEnd = -1;
+    int skipped = 0;
+    while (cnt < maxSize && skipped < 2 * HID_REPORT_SIZE) {
+        int readTimeout = -1;
+        if (token)
+            readTimeout = DBB_CANCEL_POLL_INTERVAL_MS;
+        if (timeoutMS >= 0) {
+            long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+            if (remaining <= 0)
+                return DBB_COMMAND_STATUS_TIMEOUT;
+            if (readTimeout < 0 || remaining < readTimeout)
+                readTimeout = (int)remaining;
+        }
+
+        //chunked responses are reassembled in the growing report buffer
+        size_t len = std::min((size_t)HID_REPORT_SIZE, maxSize - cnt);
+        if (report.size() < cnt + len)
+            report.resize(cnt + len);
+
+        res = transport->read(&report[cnt], len, readTimeout);
+        if (res < 0)
+            return DBB_COMMAND_STATUS_IO_ERROR;
+        if (token && token->isCanceled())
+            return DBB_COMMAND_STATUS_CANCELED;
+        if (res == 0)
+            continue;
+        nBytesRead += res;
+
+        if (framed) {
+            int start = 0;
+            if (cnt == 0) {
+                //skip padding left over from a previous report
+                while (start < res && report[start] == 0)
+                    start++;
+                skipped += start;
+                if (start > 0) {
+                    memmove(&report[0], &report[start], res - start);
+                    res -= start;
+                    start = 0;
+                }
+
+                //no json response (old firmware), read the full report(s)
+                if (res > 0 && report[0] != '{')
+                    framed = false;
+            }
+            if (framed && res > 0) {
+                int pos = scanner.scan(&report[cnt], res);
+                if (pos >= 0) {
+                    frameEnd = cnt + pos;
+                    cnt += res;
+                    break;
+                }
+            }
+        }
+        //an unframed chunked response ends with the report containing the NUL terminator
+        if (chunkedMode && !framed && memchr(&report[cnt], 0, res))
+            terminated = true;
+        cnt += res;
+        if (terminated && cnt % HID_REPORT_SIZE == 0)
+            break;
+    }
+
+    //only padding arrived, there is no response to return
+    if (cnt == 0)
+        return DBB_COMMAND_STATUS_TIMEOUT;
+
+    DBB_DEBUG_INTERNAL(" OK, read %d bytes.\n", (int)cnt);
+
+    if (frameEnd >= 0)
+        resultOut.assign((const char*)&report[0], frameEnd);
+    else
+        resultOut.assign((const char*)&report[0], strnlen((const char*)&report[0], cnt));
+    return DBB_COMMAND_STATUS_OK;
+}
+
+//update the connection state after a command
+dbb_command_status_t Connection::finishCommand(dbb_command_status_t status)
+{
+    if (status == DBB_COMMAND_STATUS_TIMEOUT) {
+        nTimeouts++;
+    } else if (status == DBB_COMMAND_STATUS_CANCELED) {
+        nCancellations++;
+    } else if (status == DBB_COMMAND_STATUS_IO_ERROR) {
+        //the device is gone (or unusable), a reconnect is required
+        nErrors++;
+        deviceLost = true;
+        opened = false;
+    }
+
+    return status;
+}
+
+dbb_command_status_t Connection::sendCommand(const std::string& json, std::string& resultOut, int timeoutMS, const CancellationToken* token)
+{
+    return sendCommand(json.data(), json.size(), resultOut, timeoutMS, token);
+}
+
+dbb_command_status_t Connection::sendCommand(const char* json, size_t jsonLen, std::string& resultOut, int timeoutMS, const CancellationToken* token)
+{
+    std::lock_guard<std::mutex> lock(cs_connection);
+    return finishCommand(exchangeCommand((const unsigned char*)json, jsonLen, resultOut, timeoutMS, token));
+}
+
+dbb_command_status_t Connection::sendEncryptedCommand(const char* cmd, size_t cmdLen, const SessionKey& key, std::string& resultOut, int timeoutMS, const CancellationToken* token)
+{
+    std::lock_guard<std::mutex> lock(cs_connection);
+
+    //encrypt and encode directly into the report buffer, it gets written from there
+    size_t size = encryptedCommandSize(cmdLen);
+    if (size > (chunked ? DBB_CHUNKED_MAX_SIZE : HID_REPORT_SIZE))
+        return DBB_COMMAND_STATUS_TOO_LARGE;
+    if (report.size() < size)
+        report.resize(size);
+
+    size = encryptAndEncodeCommand(cmd, cmdLen, key, (char*)&report[0], report.size());
+    if (size == 0)
+        return DBB_COMMAND_STATUS_ENCRYPTION_FAILED;
+
+    return finishCommand(exchangeCommand(&report[0], size, resultOut, timeoutMS, token));
+}
+
+bool Connection::sendCommand(const std::string& json, std::string& resultOut)
+{
+    dbb_command_status_t status = sendCommand(json, resultOut, -1, NULL);
+    if (status == DBB_COMMAND_STATUS_IO_ERROR)
+        throw std::runtime_error("Error: Unable to read HID(USB) report.\n");
+    if (status == DBB_COMMAND_STATUS_TOO_LARGE)
+        throw std::runtime_error("Error: Command exceeds the HID report size.\n");
+
+    return (status == DBB_COMMAND_STATUS_OK);
+}
+}
@@ -0,0 +1,136 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LIBDBB_CONNECTION_H
+#define LIBDBB_CONNECTION_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../include/dbb.h"
+#include "securemem.h"
+#include "transport.h"
+
+namespace DBB
+{
+//!upper bound for a chunked request or response
+#define DBB_CHUNKED_MAX_SIZE (64 * HID_REPORT_SIZE)
+
+//!snapshot of the I/O counters of a connection
+class ConnectionStats
+{
+public:
+    uint64_t commands;      //!< commands written to the device
+    uint64_t bytesWritten;  //!< bytes written (including report padding)
+    uint64_t bytesRead;     //!< bytes read
+    uint64_t timeouts;      //!< commands aborted because of a timeout
+    uint64_t cancellations; //!< commands aborted over a cancellation token
+    uint64_t errors;        //!< commands failed with an I/O error
+};
+
+//!a connection to a single device
+// owns the transport, the report buffer and the I/O statistics; commands on
+// the same connection are serialized, different connections share no state
+// and can be used from different threads at the same time
+class Connection
+{
+public:
+    //!the default transport is hidapi
+    Connection(std::unique_ptr<Transport> transportIn = std::unique_ptr<Transport>());
+    ~Connection();
+
+    //!replace the transport, an open device gets closed
+    void setTransport(std::unique_ptr<Transport> transportIn);
+
+    //!record all reports of this connection to a capture file (see CaptureTransport)
+    // returns false if the file could not be created
+    bool startCapture(const std::string& filename);
+
+    //!stop recording, returns false if no capture was running
+    bool stopCapture();
+
+    //!open the device with the given path, an empty path opens the first available device
+    bool open(const std::string& pathIn = "");
+
+    //!close the device, returns false if no device was open
+    bool close();
+
+    //!returns true if the device is open and alive (cached, does not enumerate)
+    // the state is set by open() and cleared by close(), an I/O error or deviceDetached()
+    bool isOpen() const;
+
+    //!enumerate the devices and clear the liveness if the open device is gone
+    // for platforms without hotplug events, returns isOpen()
+    bool verify();
+
+    //!a device got detached, clears the liveness if it was the open device
+    // (detach events with an unknown path are verified over an enumeration)
+    void deviceDetached(const std::string& detachedPath);
+
+    //!returns the paths of all devices available over the transport of this connection
+    std::vector<std::string> enumerate();
+
+    //!returns the path of the open device
+    std::string getPath() const;
+
+    void setReadMode(dbb_read_mode_t mode);
+
+    //!enable streaming of requests and responses larger than one report
+    // (see setChunkedTransfer() in dbb.h)
+    void setChunkedTransfer(bool enabled);
+
+    //!send a json command and read the response
+    // throws a runtime_error in case of an I/O error
+    bool sendCommand(const std::string& json, std::string& resultOut);
+
+    //!send a json command and read the response, waits at most timeoutMS
+    // milliseconds (-1 = no timeout) or until the token gets canceled
+    dbb_command_status_t sendCommand(const std::string& json, std::string& resultOut, int timeoutMS, const CancellationToken* token);
+    dbb_command_status_t sendCommand(const char* json, size_t jsonLen, std::string& resultOut, int timeoutMS, const CancellationToken* token);
+
+    //!encrypt and encode the command straight into the report buffer and send it
+    // the response is returned as it is (still encrypted)
+    dbb_command_status_t sendEncryptedCommand(const char* cmd, size_t cmdLen, const SessionKey& key, std::string& resultOut, int timeoutMS, const CancellationToken* token);
+
+    //!returns the I/O counters, does not block while a command is in process
+    ConnectionStats getStats() const;
+
+private:
+    mutable std::mutex cs_connection; //!< serializes commands, open and close
+    mutable std::mutex cs_transport;  //!< guards the transport pointer and the path only
+    std::shared_ptr<Transport> transport;
+    std::string path;
+    SecureBytes report; //!< I/O buffer in the LockedPool, grows for chunked responses
+    unsigned int staleReplies; //!< replies of aborted commands the device still owes
+    std::atomic<bool> opened;
+    std::atomic<bool> deviceLost; //!< the device went away, it owes no replies after a reconnect
+    std::atomic<int> readMode;
+    std::atomic<bool> chunked;
+
+    std::atomic<uint64_t> nCommands;
+    std::atomic<uint64_t> nBytesWritten;
+    std::atomic<uint64_t> nBytesRead;
+    std::atomic<uint64_t> nTimeouts;
+    std::atomic<uint64_t> nCancellations;
+    std::atomic<uint64_t> nErrors;
+
+    Connection(const Connection&);
+    Connection& operator=(const Connection&);
+
+    bool writeRequest(const unsigned char* data, size_t size, bool chunkedMode);
+    dbb_command_status_t finishCommand(dbb_command_status_t status);
+    dbb_command_status_t exchangeCommand(const unsigned char* request, size_t size, std::string& resultOut, int timeoutMS, const CancellationToken* token);
+    dbb_command_status_t readResponse(std::string& resultOut, size_t maxSize, bool chunkedMode, const std::chrono::steady_clock::time_point& deadline, int timeoutMS, const CancellationToken* token);
+};
+
+//!the connection used by openConnection(), sendCommand(), ...
+Connection& defaultConnection();
+}
+#endif // LIBDBB_CONNECTION_H
@@ -3,97 +3,257 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "crypto.h"
+#include "securemem.h"
 
 #include <openssl/aes.h>
 #include <openssl/bio.h>
 #include <openssl/buffer.h>
+#include <openssl/crypto.h>
 #include <openssl/evp.h>
-#include <openssl/sha.h>
 #include <openssl/rand.h>
 
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <atomic>
+#include <mutex>
+
+#ifndef WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 //ignore osx depracation warning
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
 
 void doubleSha256(char* string, unsigned char* hashOut)
 {
-    unsigned char firstSha[SHA256_DIGEST_LENGTH];
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-    SHA256_Update(&sha256, string, strlen(string));
-    SHA256_Final(firstSha, &sha256);
+    doubleSha256((const unsigned char*)string, strlen(string), hashOut);
+}
 
-    SHA256_Init(&sha256);
-    SHA256_Update(&sha256, firstSha, SHA256_DIGEST_LENGTH);
-    SHA256_Final(hashOut, &sha256);
+void doubleSha256(const unsigned char* data, size_t len, unsigned char* hashOut)
+{
+    unsigned char firstSha[DBB_SHA256_DIGEST_LENGTH];
+    SHA256Hasher hasher;
+    hasher.write(data, len).finalize(firstSha);
+    hasher.write(firstSha, DBB_SHA256_DIGEST_LENGTH).finalize(hashOut);
+    memoryCleanse(firstSha, DBB_SHA256_DIGEST_LENGTH);
 }
 
+AESCipherEngine::AESCipherEngine() : ctx(EVP_CIPHER_CTX_new())
+{
+    //the cipher is set once, every operation only sets key, IV and direction
+    if (ctx && !EVP_CipherInit_ex(ctx, EVP_aes_256_cbc(), NULL, NULL, NULL, 1)) {
+        EVP_CIPHER_CTX_free(ctx);
+        ctx = NULL;
+    }
+}
+
+AESCipherEngine::~AESCipherEngine()
+{
+    if (ctx)
+        EVP_CIPHER_CTX_free(ctx);
+}
 
-bool aesDecrypt(unsigned char* aesKey, unsigned char* aesIV, unsigned char* encMsg, size_t encMsgLen, unsigned char** decMsg, int* outlen)
+AESCipherEngine& AESCipherEngine::threadInstance()
 {
-    size_t decLen = 0;
-    size_t blockLen = 0;
+    static thread_local AESCipherEngine engine;
+    return engine;
+}
 
-    EVP_CIPHER_CTX* aesDecryptCtx = (EVP_CIPHER_CTX*)malloc(sizeof(EVP_CIPHER_CTX));
-    EVP_CIPHER_CTX_init(aesDecryptCtx);
+bool AESCipherEngine::begin(int enc, const unsigned char* aesKey, const unsigned char* aesIV)
+{
+    return (ctx && EVP_CipherInit_ex(ctx, NULL, NULL, aesKey, aesIV, enc));
+}
 
-    *decMsg = (unsigned char*)malloc(encMsgLen);
-    if (*decMsg == NULL)
-        return false;
+int AESCipherEngine::update(const unsigned char* in, size_t inLen, unsigned char* out)
+{
+    int len = 0;
+    if (inLen > INT_MAX - DBB_AES_BLOCKSIZE || !EVP_CipherUpdate(ctx, out, &len, in, (int)inLen))
+        return -1;
+    return len;
+}
 
-    if (!EVP_DecryptInit_ex(aesDecryptCtx, EVP_aes_256_cbc(), NULL, aesKey, aesIV)) {
-        return false;
-    }
+int AESCipherEngine::finish(unsigned char* out)
+{
+    int len = 0;
+    if (!EVP_CipherFinal_ex(ctx, out, &len))
+        return -1;
+    return len;
+}
+
+int AESCipherEngine::crypt(int enc, const unsigned char* aesKey, const unsigned char* aesIV, const unsigned char* in, size_t inLen, unsigned char* out)
+{
+    if (!begin(enc, aesKey, aesIV))
+        return -1;
+
+    int len = update(in, inLen, out);
+    if (len < 0)
+        return -1;
+
+    int finalLen = finish(out + len);
+    if (finalLen < 0)
+        return -1;
+
+    return len + finalLen;
+}
+
+int AESCipherEngine::encrypt(const unsigned char* aesKey, const unsigned char* aesIV, const unsigned char* msg, size_t msgLen, unsigned char* encMsg)
+{
+    return crypt(1, aesKey, aesIV, msg, msgLen, encMsg);
+}
+
+int AESCipherEngine::decrypt(const unsigned char* aesKey, const unsigned char* aesIV, const unsigned char* encMsg, size_t encMsgLen, unsigned char* decMsg)
+{
+    return crypt(0, aesKey, aesIV, encMsg, encMsgLen, decMsg);
+}
 
-    if (!EVP_DecryptUpdate(aesDecryptCtx, (unsigned char*)*decMsg, (int*)&blockLen, encMsg, (int)encMsgLen)) {
+bool aesDecrypt(const unsigned char* aesKey, const unsigned char* aesIV, const unsigned char* encMsg, size_t encMsgLen, unsigned char* decMsg, int* outlen)
+{
+    int len = AESCipherEngine::threadInstance().decrypt(aesKey, aesIV, encMsg, encMsgLen, decMsg);
+    if (len < 0)
         return false;
-    }
-    decLen += blockLen;
 
-    if (!EVP_DecryptFinal_ex(aesDecryptCtx, (unsigned char*)*decMsg + decLen, (int*)&blockLen)) {
+    *outlen = len;
+    return true;
+}
+
+int aesEncrypt(const unsigned char* aesKey, const unsigned char* aesIV, const unsigned char* msg, size_t msgLen, unsigned char* encMsg)
+{
+    return AESCipherEngine::threadInstance().encrypt(aesKey, aesIV, msg, msgLen, encMsg);
+}
+
+//read entropy from the OS, bypassing the OpenSSL RAND state
+static bool getOSRandBytes(unsigned char* out, size_t len)
+{
+#ifdef WIN32
+    return (RAND_bytes(out, len) == 1);
+#else
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0)
         return false;
+
+    size_t have = 0;
+    while (have < len) {
+        ssize_t res = read(fd, out + have, len - have);
+        if (res <= 0)
+            break;
+        have += res;
     }
-    decLen += blockLen;
+    close(fd);
+    return (have == len);
+#endif
+}
 
-    EVP_CIPHER_CTX_cleanup(aesDecryptCtx);
-    EVP_CIPHER_CTX_free(aesDecryptCtx);
-    *outlen = (int)decLen;
+//bumped in the child after a fork(), pools compare it to their own generation
+static std::atomic<unsigned int> forkCounter(0);
 
-    return true;
+#ifndef WIN32
+static void randomPoolAtFork()
+{
+    forkCounter++;
 }
+#endif
 
-int aesEncrypt(unsigned char* aesKey, unsigned char* aesIV, const unsigned char* msg, size_t msgLen, unsigned char** encMsg)
+RandomPool::RandomPool() : ctx(EVP_CIPHER_CTX_new()), state((unsigned char*)DBB::LockedPool::instance().alloc(DBB_AES_KEYSIZE + DBB_RANDPOOL_BUFFER_SIZE)), available(0), sinceReseed(0), forkGeneration(0), seeded(false)
 {
-    size_t blockLen = 0;
-    size_t encMsgLen = 0;
+#ifndef WIN32
+    static std::once_flag atforkFlag;
+    std::call_once(atforkFlag, []() { pthread_atfork(NULL, NULL, randomPoolAtFork); });
+#endif
 
-    EVP_CIPHER_CTX* aesEncryptCtx = (EVP_CIPHER_CTX*)malloc(sizeof(EVP_CIPHER_CTX));
-    EVP_CIPHER_CTX_init(aesEncryptCtx);
+    if (ctx && !EVP_EncryptInit_ex(ctx, EVP_aes_256_ctr(), NULL, NULL, NULL)) {
+        EVP_CIPHER_CTX_free(ctx);
+        ctx = NULL;
+    }
+}
+
+RandomPool::~RandomPool()
+{
+    if (ctx)
+        EVP_CIPHER_CTX_free(ctx);
+    DBB::LockedPool::instance().free(state);
+}
 
-    *encMsg = (unsigned char*)malloc(msgLen + AES_BLOCK_SIZE);
-    if (encMsg == NULL)
+RandomPool& RandomPool::threadInstance()
+{
+    static thread_local RandomPool pool;
+    return pool;
+}
+
+bool RandomPool::reseed()
+{
+    //buffered output of the old key is dropped
+    if (!getOSRandBytes(state, DBB_AES_KEYSIZE))
         return false;
 
-    if (!EVP_EncryptInit_ex(aesEncryptCtx, EVP_aes_256_cbc(), NULL, aesKey, aesIV)) {
+    memoryCleanse(state + DBB_AES_KEYSIZE, DBB_RANDPOOL_BUFFER_SIZE);
+    available = 0;
+    sinceReseed = 0;
+    lastReseed = std::chrono::steady_clock::now();
+    forkGeneration = forkCounter;
+    seeded = true;
+    return true;
+}
+
+bool RandomPool::refill()
+{
+    //the keystream of the current key replaces key and buffer, a captured
+    //state does not reveal bytes served before
+    static const unsigned char counter[DBB_AES_BLOCKSIZE] = {0};
+    if (!EVP_EncryptInit_ex(ctx, NULL, NULL, state, counter))
         return false;
-    }
 
-    if (!EVP_EncryptUpdate(aesEncryptCtx, *encMsg, (int*)&blockLen, (unsigned char*)msg, msgLen)) {
+    int len = 0;
+    memset(state, 0, DBB_AES_KEYSIZE + DBB_RANDPOOL_BUFFER_SIZE);
+    if (!EVP_EncryptUpdate(ctx, state, &len, state, DBB_AES_KEYSIZE + DBB_RANDPOOL_BUFFER_SIZE) || len != DBB_AES_KEYSIZE + DBB_RANDPOOL_BUFFER_SIZE) {
+        seeded = false;
         return false;
     }
-    encMsgLen += blockLen;
 
-    if (!EVP_EncryptFinal_ex(aesEncryptCtx, *encMsg + encMsgLen, (int*)&blockLen)) {
+    available = DBB_RANDPOOL_BUFFER_SIZE;
+    return true;
+}
+
+bool RandomPool::getBytes(unsigned char* out, size_t len)
+{
+    if (!ctx || !state)
         return false;
-    }
 
-    EVP_CIPHER_CTX_cleanup(aesEncryptCtx);
-    EVP_CIPHER_CTX_free(aesEncryptCtx);
-    return encMsgLen + blockLen;
+    if (!seeded || forkGeneration != forkCounter)
+        if (!reseed())
+            return false;
+
+    while (len > 0) {
+        if (available == 0) {
+            if (sinceReseed >= DBB_RANDPOOL_RESEED_BYTES || std::chrono::steady_clock::now() - lastReseed >= std::chrono::seconds(DBB_RANDPOOL_RESEED_SECONDS))
+                if (!reseed())
+                    return false;
+            if (!refill())
+                return false;
+        }
+
+        size_t toCopy = (len < available) ? len : available;
+        unsigned char* pos = state + DBB_AES_KEYSIZE + DBB_RANDPOOL_BUFFER_SIZE - available;
+        memcpy(out, pos, toCopy);
+        memoryCleanse(pos, toCopy);
+        out += toCopy;
+        len -= toCopy;
+        available -= toCopy;
+        sinceReseed += toCopy;
+    }
+    return true;
 }
 
 void getRandIV(unsigned char* ivOut)
 {
-    RAND_bytes(ivOut, AES_BLOCK_SIZE);
+    if (!RandomPool::threadInstance().getBytes(ivOut, DBB_AES_BLOCKSIZE))
+        RAND_bytes(ivOut, DBB_AES_BLOCKSIZE);
+}
+
+void memoryCleanse(void* ptr, size_t len)
+{
+    OPENSSL_cleanse(ptr, len);
 }
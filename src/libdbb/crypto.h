@@ -5,21 +5,160 @@
 #ifndef LIBDBB_CRYPTO_H
 #define LIBDBB_CRYPTO_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
 #include <string>
 
 #define DBB_AES_BLOCKSIZE 16
 #define DBB_AES_KEYSIZE 32
 #define DBB_SHA256_DIGEST_LENGTH 32
 
+struct evp_cipher_ctx_st;
+
 std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len);
+
+//base64 encode into out (room for base64_encoded_size(in_len) chars, not NUL terminated)
+//returns the amount of chars written; encoding a stream in pieces of multiples of 3 bytes
+//gives the same result as encoding it at once
+size_t base64_encode(const unsigned char* bytes_to_encode, size_t in_len, char* out);
+size_t base64_encoded_size(size_t in_len);
+
+//base64 decode into out (room for base64_decoded_size_max(in_len) bytes)
+//decoding stops at the first padding or non base64 char, returns the amount of bytes written
+size_t base64_decode(const char* encoded, size_t in_len, unsigned char* out);
+size_t base64_decoded_size_max(size_t in_len);
 std::string base64_decode(std::string const& encoded_string);
-bool aesDecrypt(unsigned char* aesKey, unsigned char* aesIV, unsigned char* encMsg, size_t encMsgLen, unsigned char** decMsg, int* outlen);
-int aesEncrypt(unsigned char* aesKey, unsigned char* aesIV, const unsigned char* msg, size_t msgLen, unsigned char** encMsg);
+
+//name of the block functions in use ("avx2", "ssse3" or "generic" for the scalar code)
+const char* base64_implementation();
+
+//override the block functions (one of the names above), returns false if the CPU
+//lacks them; not thread safe, meant for tests and benchmarks
+bool base64_select_implementation(const char* name);
+
+//AES-256-CBC (PKCS7 padding) over a cipher context which is allocated once per thread
+//and re-keyed for every operation, results are written into caller provided buffers
+class AESCipherEngine
+{
+public:
+    //returns the engine of the calling thread
+    static AESCipherEngine& threadInstance();
+
+    //encrypt msgLen bytes, encMsg needs room for msgLen + DBB_AES_BLOCKSIZE bytes
+    //returns the length of the ciphertext or -1 in case of an error
+    int encrypt(const unsigned char* aesKey, const unsigned char* aesIV, const unsigned char* msg, size_t msgLen, unsigned char* encMsg);
+
+    //decrypt encMsgLen bytes, decMsg needs room for encMsgLen bytes
+    //returns the length of the plaintext (padding removed) or -1 in case of an error
+    int decrypt(const unsigned char* aesKey, const unsigned char* aesIV, const unsigned char* encMsg, size_t encMsgLen, unsigned char* decMsg);
+
+    //streaming interface: begin() re-keys the context (enc = 1: encrypt, 0: decrypt),
+    //update()/finish() return the amount of bytes written to out or -1 in case of an error;
+    //update() writes up to inLen + DBB_AES_BLOCKSIZE - 1 bytes, finish() up to DBB_AES_BLOCKSIZE
+    bool begin(int enc, const unsigned char* aesKey, const unsigned char* aesIV);
+    int update(const unsigned char* in, size_t inLen, unsigned char* out);
+    int finish(unsigned char* out);
+
+    ~AESCipherEngine();
+
+private:
+    evp_cipher_ctx_st* ctx;
+
+    AESCipherEngine();
+    AESCipherEngine(const AESCipherEngine&);
+    AESCipherEngine& operator=(const AESCipherEngine&);
+
+    int crypt(int enc, const unsigned char* aesKey, const unsigned char* aesIV, const unsigned char* in, size_t inLen, unsigned char* out);
+};
+
+//decrypt into decMsg (room for encMsgLen bytes), outlen is the plaintext length without padding
+bool aesDecrypt(const unsigned char* aesKey, const unsigned char* aesIV, const unsigned char* encMsg, size_t encMsgLen, unsigned char* decMsg, int* outlen);
+
+//encrypt into encMsg (room for msgLen + DBB_AES_BLOCKSIZE bytes), returns the ciphertext length or -1
+int aesEncrypt(const unsigned char* aesKey, const unsigned char* aesIV, const unsigned char* msg, size_t msgLen, unsigned char* encMsg);
+
+//sha256 over the fastest compression function of the CPU (SHA-NI or portable C),
+//chosen once at runtime; the state is wiped on destruction
+class SHA256Hasher
+{
+public:
+    SHA256Hasher();
+    ~SHA256Hasher();
+
+    SHA256Hasher& write(const unsigned char* data, size_t len);
+
+    //write the digest (DBB_SHA256_DIGEST_LENGTH bytes) and reset the hasher
+    void finalize(unsigned char* hashOut);
+    void reset();
+
+private:
+    uint32_t s[8];
+    unsigned char buf[64];
+    uint64_t bytes;
+};
+
+void sha256(const unsigned char* data, size_t len, unsigned char* hashOut);
+
+//hash count independent messages, hashesOut gets count * DBB_SHA256_DIGEST_LENGTH bytes
+//on CPUs with AVX2 but without SHA-NI, batches of at least DBB_SHA256_MULTIBUFFER_MIN
+//messages are hashed eight at a time (multi-buffer)
+#define DBB_SHA256_MULTIBUFFER_MIN 4
+void sha256_many(const unsigned char* const* data, const size_t* lens, size_t count, unsigned char* hashesOut);
+
+//name of the selected implementation ("shani", "avx2" or "generic")
+const char* sha256_implementation();
+
+//override the implementation (one of the names above), returns false if the CPU
+//lacks it; not thread safe, meant for tests and benchmarks
+bool sha256_select_implementation(const char* name);
 
 //generate a two round sha256 hash
 void doubleSha256(char* string, unsigned char* hashOut);
+void doubleSha256(const unsigned char* data, size_t len, unsigned char* hashOut);
+
+//random bytes for IVs and nonces from a per thread AES-256-CTR DRBG
+//the pool refills DBB_RANDPOOL_BUFFER_SIZE bytes at once and re-keys itself from
+//its own output after every refill, the key is reseeded from the OS after
+//DBB_RANDPOOL_RESEED_BYTES bytes, DBB_RANDPOOL_RESEED_SECONDS seconds and in
+//the child after a fork(); serving bytes needs no syscall and no global lock
+#define DBB_RANDPOOL_BUFFER_SIZE 4096
+#define DBB_RANDPOOL_RESEED_BYTES (1024 * 1024)
+#define DBB_RANDPOOL_RESEED_SECONDS 300
+
+class RandomPool
+{
+public:
+    //returns the pool of the calling thread
+    static RandomPool& threadInstance();
+
+    //fill out with len random bytes, returns false if the pool could not be seeded
+    bool getBytes(unsigned char* out, size_t len);
+
+    ~RandomPool();
+
+private:
+    evp_cipher_ctx_st* ctx;
+    unsigned char* state; //[ key | buffer ], in the LockedPool
+    size_t available;     //unserved bytes at the end of the buffer
+    size_t sinceReseed;
+    std::chrono::steady_clock::time_point lastReseed;
+    unsigned int forkGeneration;
+    bool seeded;
+
+    RandomPool();
+    RandomPool(const RandomPool&);
+    RandomPool& operator=(const RandomPool&);
+
+    bool reseed();
+    bool refill();
+};
 
 //get random aes IV (16 bytes)
 void getRandIV(unsigned char* ivOut);
 
+//wipe memory (not optimized away by the compiler)
+void memoryCleanse(void* ptr, size_t len);
+
 #endif //LIBDBB_CRYPTO_H
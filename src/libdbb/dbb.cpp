@@ -8,10 +8,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <time.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <stdexcept>
+#include <thread>
 
 #ifndef _SRC_CONFIG__DBB_CONFIG_H
 #include "config/_dbb-config.h"
@@ -19,11 +24,14 @@
 
 #include "dbb_util.h"
 #include "crypto.h"
+#include "securemem.h"
 
+#include "../include/dbb.h"
 #include "../include/univalue.h"
-#include "hidapi/hidapi.h"
+#include "connection.h"
 
-#define HID_REPORT_SIZE 2048
+//size of the stack buffer between cipher and base64 encoder (multiple of 3 and of the AES block size)
+#define DBB_ENCODE_STAGE_SIZE (24 * DBB_AES_BLOCKSIZE)
 
 #ifdef DBB_ENABLE_DEBUG
 #define DBB_DEBUG_INTERNAL(format, args...) printf(format, ##args);
@@ -33,190 +41,340 @@
 
 namespace DBB
 {
-static hid_device* HID_HANDLE = NULL;
-static unsigned char HID_REPORT[HID_REPORT_SIZE] = {0};
+Connection& defaultConnection()
+{
+    //never destroyed, the async I/O thread might still use it at exit
+    static Connection* connection = new Connection();
+    return *connection;
+}
 
-static bool api_hid_init(void)
+void setTransport(std::unique_ptr<Transport> transport)
 {
-    //TODO: way to handle multiple DBB
-    HID_HANDLE = hid_open(0x03eb, 0x2402, NULL); //vendor-id, product-id
-    if (!HID_HANDLE) {
-        return false;
-    }
-    return true;
+    defaultConnection().setTransport(std::move(transport));
 }
 
-static bool api_hid_close(void)
+bool startCapture(const std::string& filename)
 {
-    //TODO: way to handle multiple DBB
-    if (HID_HANDLE) {
-        hid_close(HID_HANDLE); //vendor-id, product-id
-        return true;
-    }
+    return defaultConnection().startCapture(filename);
+}
 
-    return false;
+bool stopCapture()
+{
+    return defaultConnection().stopCapture();
 }
 
 bool isConnectionOpen()
 {
-    if (!HID_HANDLE)
-        return false;
-
-    struct hid_device_info* devs, *cur_dev;
+    return defaultConnection().isOpen();
+}
 
-    devs = hid_enumerate(0x03eb, 0x2402);
-    cur_dev = devs;
-    bool found = false;
-    while (cur_dev) {
-        found = true;
-        break;
-    }
-    hid_free_enumeration(devs);
+bool verifyConnection()
+{
+    return defaultConnection().verify();
+}
 
-    return found;
+void deviceDetached(const std::string& path)
+{
+    defaultConnection().deviceDetached(path);
 }
 
 bool openConnection()
 {
-    return api_hid_init();
+    //opens the first device, use a DeviceRegistry to handle multiple DBBs
+    return defaultConnection().open();
 }
 
 bool closeConnection()
 {
-    return api_hid_close();
+    return defaultConnection().close();
 }
 
-bool sendCommand(const std::string& json, std::string& resultOut)
+void setReadMode(dbb_read_mode_t mode)
 {
-    int res, cnt = 0;
+    defaultConnection().setReadMode(mode);
+}
 
-    if (!HID_HANDLE)
-        return false;
+void setChunkedTransfer(bool enabled)
+{
+    defaultConnection().setChunkedTransfer(enabled);
+}
 
-    DBB_DEBUG_INTERNAL("Sending command: %s\n", json.c_str());
+bool sendCommand(const std::string& json, std::string& resultOut)
+{
+    return defaultConnection().sendCommand(json, resultOut);
+}
 
-    memset(HID_REPORT, 0, HID_REPORT_SIZE);
-    memcpy(HID_REPORT, json.c_str(), json.size());
-    hid_write(HID_HANDLE, (unsigned char*)HID_REPORT, HID_REPORT_SIZE);
+dbb_command_status_t sendCommand(const std::string& json, std::string& resultOut, int timeoutMS, const CancellationTokenRef& token)
+{
+    return defaultConnection().sendCommand(json, resultOut, timeoutMS, token.get());
+}
 
-    memset(HID_REPORT, 0, HID_REPORT_SIZE);
-    DBB_DEBUG_INTERNAL("try to read some bytes...\n");
+dbb_command_status_t sendCommand(const SecureString& json, std::string& resultOut, int timeoutMS, const CancellationTokenRef& token)
+{
+    return defaultConnection().sendCommand(json.data(), json.size(), resultOut, timeoutMS, token.get());
+}
+
+//single I/O thread for asynchronous commands, commands are executed in order
+class AsyncCommandWorker
+{
+public:
+    AsyncCommandWorker() : thread(&AsyncCommandWorker::run, this) {}
+
+    void post(const std::function<void()>& job)
+    {
+        std::unique_lock<std::mutex> lock(cs_jobs);
+        jobs.push_back(job);
+        jobsCondVar.notify_one();
+    }
 
-    memset(HID_REPORT, 0, HID_REPORT_SIZE);
-    while (cnt < HID_REPORT_SIZE) {
-        res = hid_read(HID_HANDLE, HID_REPORT + cnt, HID_REPORT_SIZE);
-        if (res < 0) {
-            throw std::runtime_error("Error: Unable to read HID(USB) report.\n");
+private:
+    std::mutex cs_jobs;
+    std::condition_variable jobsCondVar;
+    std::deque<std::function<void()> > jobs;
+    std::thread thread;
+
+    void run()
+    {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(cs_jobs);
+                while (jobs.empty())
+                    jobsCondVar.wait(lock);
+                job = jobs.front();
+                jobs.pop_front();
+            }
+            job();
         }
-        cnt += res;
     }
+};
 
-    DBB_DEBUG_INTERNAL(" OK, read %d bytes.\n", res);
+static AsyncCommandWorker& asyncWorker()
+{
+    //never destroyed, the thread might still wait for a device at exit
+    static AsyncCommandWorker* worker = new AsyncCommandWorker();
+    return *worker;
+}
 
-    resultOut.assign((const char*)HID_REPORT);
-    return true;
+std::future<CommandResult> sendCommandAsync(const std::string& json, int timeoutMS, const CancellationTokenRef& token, const CommandCallback& callback, const Executor& executor)
+{
+    std::shared_ptr<std::promise<CommandResult> > promise(new std::promise<CommandResult>());
+    std::future<CommandResult> future = promise->get_future();
+
+    asyncWorker().post([json, timeoutMS, token, callback, executor, promise]() {
+        CommandResult result;
+        result.status = defaultConnection().sendCommand(json, result.response, timeoutMS, token.get());
+        promise->set_value(result);
+
+        if (!callback)
+            return;
+        if (executor)
+            executor(std::bind(callback, result));
+        else
+            callback(result);
+    });
+
+    return future;
 }
 
-bool decryptAndDecodeCommand(const std::string& cmdIn, const std::string& password, std::string& stringOut)
+SessionKey::SessionKey(const char* password) : key(NULL)
 {
+    derive(password, strlen(password));
+}
+
+SessionKey::SessionKey(const std::string& password) : key(NULL)
+{
+    derive(password.data(), password.size());
+}
+
+SessionKey::SessionKey(const SecureString& password) : key(NULL)
+{
+    derive(password.data(), password.size());
+}
+
+void SessionKey::derive(const char* password, size_t len)
+{
+    if (len == 0)
+        return;
+
+    key = (unsigned char*)LockedPool::instance().alloc(DBB_AES_KEYSIZE);
+    if (!key)
+        return;
+
     unsigned char passwordSha256[DBB_SHA256_DIGEST_LENGTH];
-    unsigned char aesIV[DBB_AES_BLOCKSIZE];
-    unsigned char aesKey[DBB_AES_KEYSIZE];
+    doubleSha256((const unsigned char*)password, len, passwordSha256);
+    memcpy(key, passwordSha256, DBB_AES_KEYSIZE);
+    memoryCleanse(passwordSha256, DBB_SHA256_DIGEST_LENGTH);
+}
 
-    doubleSha256((char*)password.c_str(), passwordSha256);
-    memcpy(aesKey, passwordSha256, DBB_AES_KEYSIZE);
+SessionKey::~SessionKey()
+{
+    LockedPool::instance().free(key);
+}
+
+bool SessionKey::isValid() const
+{
+    return (key != NULL);
+}
+
+const unsigned char* SessionKey::getKey() const
+{
+    return key;
+}
+
+//per thread scratch buffer for decoding and decrypting responses
+// lives in the LockedPool, the plaintext gets wiped after every response
+class ResponseScratch
+{
+public:
+    unsigned char* get(size_t needed)
+    {
+        //a reallocation wipes the old buffer
+        if (needed > data.size())
+            data.resize((needed + 4095) & ~(size_t)4095);
+        return &data[0];
+    }
+
+    void wipe(size_t len) { memoryCleanse(&data[0], len); }
+
+private:
+    SecureBytes data;
+};
+
+static thread_local ResponseScratch responseScratch;
+
+//base64 decode the ciphertext into the scratch buffer and decrypt it in place
+// returns the NUL terminated plaintext, scratchLen is the amount of scratch bytes to wipe
+static const char* decryptResponse(const std::string& cmdIn, const SessionKey& key, size_t& plaintextLen, size_t& scratchLen)
+{
+    if (!key.isValid())
+        throw std::runtime_error("invalid session key");
 
-    //decrypt result: TODO:
     UniValue valRead(UniValue::VSTR);
     if (!valRead.read(cmdIn))
         throw std::runtime_error("failed deserializing json");
 
-    UniValue input = find_value(valRead, "input");
-    if (!input.isNull() && input.isObject()) {
-        UniValue error = find_value(input, "error");
-        if (!error.isNull() && error.isStr())
+    const UniValue& input = find_value(valRead, "input");
+    if (input.isObject()) {
+        const UniValue& error = find_value(input, "error");
+        if (error.isStr())
             throw std::runtime_error("Error decrypting: " + error.get_str());
     }
 
-    UniValue ctext = find_value(valRead, "ciphertext");
-    if (ctext.isNull())
+    const UniValue& ctext = find_value(valRead, "ciphertext");
+    if (!ctext.isStr())
         throw std::runtime_error("failed deserializing json");
 
-    std::string base64dec = base64_decode(ctext.get_str());
-    unsigned int base64_len = base64dec.size();
-    unsigned char* base64dec_c = (unsigned char*)base64dec.c_str();
+    const std::string& base64str = ctext.getValStr();
+    unsigned char* buf = responseScratch.get(base64_decoded_size_max(base64str.size()) + 1);
 
-    unsigned char* decryptedStream;
-    unsigned char* decryptedCommand;
-    memcpy(aesIV, base64dec_c, DBB_AES_BLOCKSIZE); //copy first 16 bytes and take as IV
-    int outlen = 0;
-    if (!aesDecrypt(aesKey, aesIV, base64dec_c + DBB_AES_BLOCKSIZE, base64_len - DBB_AES_BLOCKSIZE, &decryptedStream, &outlen))
+    // [ iv | ciphertext ], the cipher copies the iv on init
+    scratchLen = base64_decode(base64str.data(), base64str.size(), buf);
+    if (scratchLen < 2 * DBB_AES_BLOCKSIZE)
         throw std::runtime_error("decryption failed");
 
-    int decrypt_len = 0;
-    int padlen = decryptedStream[base64_len - DBB_AES_BLOCKSIZE - 1];
-    char* dec = (char*)malloc(base64_len - DBB_AES_BLOCKSIZE - padlen + 1); // +1 for null termination
-    if (!dec) {
-        decrypt_len = 0;
-        memset(decryptedStream, 0, sizeof(&decryptedStream));
-        free(decryptedStream);
-        throw std::runtime_error("decription failed");
-        return false;
+    int outlen = 0;
+    unsigned char* ciphertext = buf + DBB_AES_BLOCKSIZE;
+    if (!aesDecrypt(key.getKey(), buf, ciphertext, scratchLen - DBB_AES_BLOCKSIZE, ciphertext, &outlen)) {
+        responseScratch.wipe(scratchLen);
+        throw std::runtime_error("decryption failed");
     }
-    memcpy(dec, decryptedStream, base64_len - DBB_AES_BLOCKSIZE - padlen);
-    dec[base64_len - DBB_AES_BLOCKSIZE - padlen] = 0;
-    decrypt_len = base64_len - DBB_AES_BLOCKSIZE - padlen + 1;
-    memset(decryptedStream, 0, sizeof(&decryptedStream));
-    free(decryptedStream);
-
-    stringOut.assign((const char*)dec);
-    free(dec);
+    ciphertext[outlen] = 0;
+    plaintextLen = outlen;
+
+    return (const char*)ciphertext;
+}
+
+bool decryptAndDecodeCommand(const std::string& cmdIn, const SessionKey& key, std::string& stringOut)
+{
+    size_t plaintextLen, scratchLen;
+    const char* plaintext = decryptResponse(cmdIn, key, plaintextLen, scratchLen);
+    stringOut.assign(plaintext, plaintextLen);
+    responseScratch.wipe(scratchLen);
     return true;
 }
 
-bool encryptAndEncodeCommand(const std::string& cmd, const std::string& password, std::string& base64strOut)
+bool decryptAndDecodeCommand(const std::string& cmdIn, const SessionKey& key, SecureString& stringOut)
 {
-    if (password.empty())
-        return false;
+    size_t plaintextLen, scratchLen;
+    const char* plaintext = decryptResponse(cmdIn, key, plaintextLen, scratchLen);
+    stringOut.assign(plaintext, plaintextLen);
+    responseScratch.wipe(scratchLen);
+    return true;
+}
 
-    //double sha256 the password
-    unsigned char passwordSha256[DBB_SHA256_DIGEST_LENGTH];
-    unsigned char* cypher;
-    unsigned char aesIV[DBB_AES_BLOCKSIZE];
-    unsigned char aesKey[DBB_AES_KEYSIZE];
-
-    doubleSha256((char*)password.c_str(), passwordSha256);
-
-    //set random IV
-    getRandIV(aesIV);
-    memcpy(aesKey, passwordSha256, DBB_AES_KEYSIZE);
-
-    int inlen = cmd.size();
-    unsigned int pads = 0;
-    int inpadlen = inlen + DBB_AES_BLOCKSIZE - inlen % DBB_AES_BLOCKSIZE;
-    unsigned char inpad[inpadlen];
-    unsigned char enc[inpadlen];
-    unsigned char enc_cat[inpadlen + DBB_AES_BLOCKSIZE]; // concatenating [ iv0  |  enc ]
-
-    // PKCS7 padding
-    memcpy(inpad, cmd.c_str(), inlen);
-    for (pads = 0; pads < DBB_AES_BLOCKSIZE - inlen % DBB_AES_BLOCKSIZE; pads++) {
-        inpad[inlen + pads] = (DBB_AES_BLOCKSIZE - inlen % DBB_AES_BLOCKSIZE);
+bool decryptAndDecodeCommand(const std::string& cmdIn, const SessionKey& key, UniValue& valueOut)
+{
+    size_t plaintextLen, scratchLen;
+    const char* plaintext = decryptResponse(cmdIn, key, plaintextLen, scratchLen);
+    bool parsed = valueOut.read(plaintext, plaintextLen);
+    responseScratch.wipe(scratchLen);
+    if (!parsed)
+        throw std::runtime_error("failed deserializing decrypted json");
+    return true;
+}
+
+size_t encryptedCommandSize(size_t cmdLen)
+{
+    // [ iv | ciphertext (PKCS7 padded) ]
+    return base64_encoded_size(DBB_AES_BLOCKSIZE + cmdLen + DBB_AES_BLOCKSIZE - cmdLen % DBB_AES_BLOCKSIZE);
+}
+
+size_t encryptAndEncodeCommand(const char* cmd, size_t cmdLen, const SessionKey& key, char* out, size_t outLen)
+{
+    if (!key.isValid() || outLen < encryptedCommandSize(cmdLen))
+        return 0;
+
+    //the iv and the ciphertext are staged in a small stack buffer and handed to
+    //the base64 encoder in multiples of 3 bytes, the cipher adds the padding
+    AESCipherEngine& engine = AESCipherEngine::threadInstance();
+    unsigned char stage[DBB_ENCODE_STAGE_SIZE];
+    size_t staged = DBB_AES_BLOCKSIZE;
+    getRandIV(stage);
+    if (!engine.begin(1, key.getKey(), stage))
+        return 0;
+
+    char* pos = out;
+    size_t cmdPos = 0;
+    while (cmdPos < cmdLen) {
+        size_t take = std::min(cmdLen - cmdPos, sizeof(stage) - staged - DBB_AES_BLOCKSIZE);
+        int len = engine.update((const unsigned char*)cmd + cmdPos, take, stage + staged);
+        if (len < 0)
+            return 0;
+        cmdPos += take;
+        staged += len;
+
+        size_t flush = staged - staged % 3;
+        pos += base64_encode(stage, flush, pos);
+        memmove(stage, stage + flush, staged - flush);
+        staged -= flush;
     }
 
-    //add iv to the stream for base64 encoding
-    memcpy(enc_cat, aesIV, DBB_AES_BLOCKSIZE);
+    int len = engine.finish(stage + staged);
+    if (len < 0)
+        return 0;
+    staged += len;
+    pos += base64_encode(stage, staged, pos);
 
-    //encrypt
-    aesEncrypt(aesKey, aesIV, inpad, inlen, &cypher);
+    return pos - out;
+}
+
+bool encryptAndEncodeCommand(const std::string& cmd, const SessionKey& key, std::string& base64strOut)
+{
+    base64strOut.resize(encryptedCommandSize(cmd.size()));
+    size_t len = encryptAndEncodeCommand(cmd.data(), cmd.size(), key, &base64strOut[0], base64strOut.size());
+    base64strOut.resize(len);
 
-    //copy the encypted data to the stream where the iv is already
-    memcpy(enc_cat + DBB_AES_BLOCKSIZE, cypher, inpadlen);
-    free(cypher);
+    return (len > 0);
+}
 
-    //base64 encode
-    base64strOut = base64_encode(enc_cat, inpadlen + DBB_AES_BLOCKSIZE);
+dbb_command_status_t sendEncryptedCommand(const std::string& cmd, const SessionKey& key, std::string& resultOut, int timeoutMS, const CancellationTokenRef& token)
+{
+    return defaultConnection().sendEncryptedCommand(cmd.data(), cmd.size(), key, resultOut, timeoutMS, token.get());
+}
 
-    return true;
+dbb_command_status_t sendEncryptedCommand(const SecureString& cmd, const SessionKey& key, std::string& resultOut, int timeoutMS, const CancellationTokenRef& token)
+{
+    return defaultConnection().sendEncryptedCommand(cmd.data(), cmd.size(), key, resultOut, timeoutMS, token.get());
 }
 }
@@ -0,0 +1,146 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "hotplug.h"
+
+#ifndef _SRC_CONFIG__DBB_CONFIG_H
+#include "config/_dbb-config.h"
+#endif
+
+#include "transport.h"
+
+#ifdef DBB_HAVE_LIBUDEV
+#include <libudev.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+namespace DBB
+{
+HotplugMonitor::HotplugMonitor() : running(false), udevContext(NULL), udevMonitor(NULL)
+{
+    stopPipe[0] = stopPipe[1] = -1;
+}
+
+HotplugMonitor::~HotplugMonitor()
+{
+    stop();
+}
+
+#ifdef DBB_HAVE_LIBUDEV
+bool HotplugMonitor::start(const Callback&)
+{
+    if (running)
+        return true;
+
+    struct udev* udev = udev_new();
+    if (!udev)
+        return false;
+
+    struct udev_monitor* monitor = udev_monitor_new_from_netlink(udev, "udev");
+    if (!monitor || udev_monitor_filter_add_match_subsystem_devtype(monitor, "hidraw", NULL) < 0 || udev_monitor_enable_receiving(monitor) < 0 || pipe(stopPipe) != 0) {
+        if (monitor)
+            udev_monitor_unref(monitor);
+        udev_unref(udev);
+        stopPipe[0] = stopPipe[1] = -1;
+        return false;
+    }
+
+    udevContext = udev;
+    udevMonitor = monitor;
+    callback = callbackIn;
+    running = true;
+    monitorThread = std::thread(&HotplugMonitor::threadMain, this);
+    return true;
+}
+
+void HotplugMonitor::stop()
+{
+    if (!running)
+        return;
+
+    running = false;
+    if (write(stopPipe[1], "x", 1) != 1)
+        perror("HotplugMonitor: could not wake up the monitor thread");
+    if (monitorThread.joinable())
+        monitorThread.join();
+
+    close(stopPipe[0]);
+    close(stopPipe[1]);
+    stopPipe[0] = stopPipe[1] = -1;
+    udev_monitor_unref((struct udev_monitor*)udevMonitor);
+    udev_unref((struct udev*)udevContext);
+    udevMonitor = NULL;
+    udevContext = NULL;
+}
+
+//returns true if the hidraw device belongs to a digital bitbox
+static bool isDBBDevice(struct udev_device* dev)
+{
+    struct udev_device* usbDev = udev_device_get_parent_with_subsystem_devtype(dev, "usb", "usb_device");
+    if (!usbDev)
+        return false;
+
+    const char* vendor = udev_device_get_sysattr_value(usbDev, "idVendor");
+    const char* product = udev_device_get_sysattr_value(usbDev, "idProduct");
+    if (!vendor || !product)
+        return false;
+
+    char vendorHex[5], productHex[5];
+    snprintf(vendorHex, sizeof(vendorHex), "%04x", DBB_USB_VENDOR_ID);
+    snprintf(productHex, sizeof(productHex), "%04x", DBB_USB_PRODUCT_ID);
+    return (strcmp(vendor, vendorHex) == 0 && strcmp(product, productHex) == 0);
+}
+
+void HotplugMonitor::threadMain()
+{
+    struct udev_monitor* monitor = (struct udev_monitor*)udevMonitor;
+    struct pollfd fds[2];
+    fds[0].fd = udev_monitor_get_fd(monitor);
+    fds[0].events = POLLIN;
+    fds[1].fd = stopPipe[0];
+    fds[1].events = POLLIN;
+
+    while (running) {
+        if (poll(fds, 2, -1) <= 0)
+            continue;
+        if (fds[1].revents & POLLIN)
+            break;
+        if (!(fds[0].revents & POLLIN))
+            continue;
+
+        struct udev_device* dev = udev_monitor_receive_device(monitor);
+        if (!dev)
+            continue;
+
+        const char* action = udev_device_get_action(dev);
+        const char* devnode = udev_device_get_devnode(dev);
+        std::string path(devnode ? devnode : "");
+        if (action && strcmp(action, "add") == 0) {
+            if (isDBBDevice(dev))
+                callback(true, path);
+        } else if (action && strcmp(action, "remove") == 0)
+            callback(false, path);
+
+        udev_device_unref(dev);
+    }
+}
+#else
+bool HotplugMonitor::start(const Callback&)
+{
+    //no hotplug events on this platform, caller has to poll
+    return false;
+}
+
+void HotplugMonitor::stop()
+{
+}
+
+void HotplugMonitor::threadMain()
+{
+}
+#endif
+}
@@ -0,0 +1,48 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LIBDBB_HOTPLUG_H
+#define LIBDBB_HOTPLUG_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+namespace DBB
+{
+//!pushes USB attach/detach events of digital bitbox devices
+// uses udev (netlink) on linux; on other platforms start() returns false
+// and the caller has to fall back to polling
+class HotplugMonitor
+{
+public:
+    //!attached is false for detach events, path is the device node (hidraw)
+    // detach events can't be matched against vendor/product ids anymore
+    // (sysfs is already gone), they are reported for every hidraw device
+    typedef std::function<void(bool attached, const std::string& path)> Callback;
+
+    HotplugMonitor();
+    ~HotplugMonitor();
+
+    //!start the monitor thread, returns false if hotplug events are not available
+    bool start(const Callback& callbackIn);
+
+    //!stop the monitor thread
+    void stop();
+
+    bool isRunning() const { return running; }
+
+private:
+    Callback callback;
+    std::thread monitorThread;
+    std::atomic<bool> running;
+    int stopPipe[2];
+    void* udevContext;
+    void* udevMonitor;
+
+    void threadMain();
+};
+}
+#endif // LIBDBB_HOTPLUG_H
@@ -0,0 +1,162 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "registry.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "../include/dbb.h"
+#include "../include/univalue.h"
+
+namespace DBB
+{
+static Transport* createHIDTransport()
+{
+    return new HIDTransport();
+}
+
+DeviceRegistry::DeviceRegistry(const TransportFactory& factoryIn) : factory(factoryIn)
+{
+    if (!factory)
+        factory = createHIDTransport;
+}
+
+DeviceRegistry::~DeviceRegistry()
+{
+    clear();
+}
+
+std::string DeviceRegistry::querySerial(Connection& connection, const SessionKeyRef& key)
+{
+    std::string cmd = "{\"device\" : \"serial\"}";
+    std::string response;
+    try {
+        if (!key) {
+            if (!connection.sendCommand(cmd, response))
+                return "";
+        } else {
+            std::string base64str;
+            std::string encryptedResponse;
+            if (!encryptAndEncodeCommand(cmd, *key, base64str))
+                return "";
+            if (!connection.sendCommand(base64str, encryptedResponse))
+                return "";
+            decryptAndDecodeCommand(encryptedResponse, *key, response);
+        }
+    } catch (const std::exception& ex) {
+        return "";
+    }
+
+    UniValue json;
+    if (!json.read(response))
+        return "";
+
+    UniValue serial = find_value(json, "serial");
+    if (serial.isNull())
+        serial = find_value(find_value(json, "device"), "serial");
+    if (!serial.isStr())
+        return "";
+
+    return serial.get_str();
+}
+
+size_t DeviceRegistry::refresh(const SessionKeyRef& key)
+{
+    //enumerating and identifying devices blocks on I/O, the registry stays
+    //available meanwhile and only the result is swapped in under cs_devices
+    std::lock_guard<std::mutex> refreshLock(cs_refresh);
+
+    std::unique_ptr<Transport> enumerator(factory());
+    std::vector<std::string> paths = enumerator->enumerate();
+
+    std::vector<std::string> knownPaths;
+    {
+        std::lock_guard<std::mutex> lock(cs_devices);
+        for (const auto& entry : devices)
+            knownPaths.push_back(entry.second->getPath());
+    }
+
+    //open and identify new devices
+    std::map<std::string, std::shared_ptr<Connection> > newDevices;
+    for (const std::string& path : paths) {
+        if (std::find(knownPaths.begin(), knownPaths.end(), path) != knownPaths.end())
+            continue;
+
+        std::shared_ptr<Connection> connection(new Connection(std::unique_ptr<Transport>(factory())));
+        if (!connection->open(path))
+            continue;
+
+        std::string serial = querySerial(*connection, key);
+        if (serial.empty())
+            serial = path;
+        newDevices[serial] = connection;
+    }
+
+    //drop detached devices, they get closed after releasing the lock
+    //(closing waits for a command in process)
+    std::vector<std::shared_ptr<Connection> > detached;
+    size_t count;
+    {
+        std::lock_guard<std::mutex> lock(cs_devices);
+        std::map<std::string, std::shared_ptr<Connection> >::iterator it = devices.begin();
+        while (it != devices.end()) {
+            if (std::find(paths.begin(), paths.end(), it->second->getPath()) == paths.end()) {
+                detached.push_back(it->second);
+                devices.erase(it++);
+            } else
+                ++it;
+        }
+        for (auto& entry : newDevices)
+            devices[entry.first] = entry.second;
+        count = devices.size();
+    }
+
+    for (auto& connection : detached)
+        connection->close();
+
+    return count;
+}
+
+std::vector<std::string> DeviceRegistry::serials() const
+{
+    std::lock_guard<std::mutex> lock(cs_devices);
+    std::vector<std::string> result;
+    for (const auto& entry : devices)
+        result.push_back(entry.first);
+    return result;
+}
+
+bool DeviceRegistry::exists(const std::string& serial) const
+{
+    return (getConnection(serial) != nullptr);
+}
+
+std::shared_ptr<Connection> DeviceRegistry::getConnection(const std::string& serial) const
+{
+    std::lock_guard<std::mutex> lock(cs_devices);
+    std::map<std::string, std::shared_ptr<Connection> >::const_iterator it = devices.find(serial);
+    if (it == devices.end())
+        return nullptr;
+    return it->second;
+}
+
+bool DeviceRegistry::sendCommand(const std::string& serial, const std::string& json, std::string& resultOut)
+{
+    //the connection serializes its own commands, other devices stay available
+    std::shared_ptr<Connection> connection = getConnection(serial);
+    if (!connection)
+        return false;
+
+    return connection->sendCommand(json, resultOut);
+}
+
+void DeviceRegistry::clear()
+{
+    std::lock_guard<std::mutex> lock(cs_devices);
+    for (auto& entry : devices)
+        entry.second->close();
+    devices.clear();
+}
+}
@@ -0,0 +1,63 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LIBDBB_REGISTRY_H
+#define LIBDBB_REGISTRY_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "connection.h"
+#include "transport.h"
+
+namespace DBB
+{
+//!keeps an open connection to every attached device, keyed by its serial number
+// commands to different devices run in parallel, commands to the same
+// device are serialized
+class DeviceRegistry
+{
+public:
+    typedef std::function<Transport*()> TransportFactory;
+
+    //!the default factory creates hidapi transports
+    DeviceRegistry(const TransportFactory& factoryIn = TransportFactory());
+    ~DeviceRegistry();
+
+    //!enumerate all devices, open new ones and drop the ones which are gone
+    // new devices are identified over the "sn" command (encrypted if a session key is given),
+    // devices not reporting a serial number are keyed by their path
+    // returns the amount of registered devices
+    size_t refresh(const SessionKeyRef& key = SessionKeyRef());
+
+    //!returns the serial numbers of all registered devices
+    std::vector<std::string> serials() const;
+
+    //!returns true if a device with the given serial number is registered
+    bool exists(const std::string& serial) const;
+
+    //!send a json command to the device with the given serial number
+    // returns false if no such device is registered
+    bool sendCommand(const std::string& serial, const std::string& json, std::string& resultOut);
+
+    //!close and remove all devices
+    void clear();
+
+    //!returns the connection of the device with the given serial number or nullptr
+    std::shared_ptr<Connection> getConnection(const std::string& serial) const;
+
+private:
+    TransportFactory factory;
+    std::mutex cs_refresh; //!< serializes refresh(), not held by the other calls
+    mutable std::mutex cs_devices;
+    std::map<std::string, std::shared_ptr<Connection> > devices;
+
+    std::string querySerial(Connection& connection, const SessionKeyRef& key);
+};
+}
+#endif // LIBDBB_REGISTRY_H
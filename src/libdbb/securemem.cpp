@@ -0,0 +1,203 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "securemem.h"
+
+#include "crypto.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace DBB
+{
+static size_t alignUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+unsigned char* LockedPool::Slab::alloc(size_t size)
+{
+    //best fit, keeps the large chunks for large requests
+    std::map<unsigned char*, size_t>::iterator best = freeChunks.end();
+    for (std::map<unsigned char*, size_t>::iterator it = freeChunks.begin(); it != freeChunks.end(); ++it)
+        if (it->second >= size && (best == freeChunks.end() || it->second < best->second))
+            best = it;
+    if (best == freeChunks.end())
+        return NULL;
+
+    unsigned char* ptr = best->first;
+    size_t remaining = best->second - size;
+    freeChunks.erase(best);
+    if (remaining > 0)
+        freeChunks[ptr + size] = remaining;
+    usedChunks[ptr] = size;
+    return ptr;
+}
+
+bool LockedPool::Slab::free(unsigned char* ptr)
+{
+    std::unordered_map<unsigned char*, size_t>::iterator used = usedChunks.find(ptr);
+    if (used == usedChunks.end())
+        return false;
+
+    size_t size = used->second;
+    usedChunks.erase(used);
+    memoryCleanse(ptr, size);
+
+    //merge with the neighbours
+    std::map<unsigned char*, size_t>::iterator next = freeChunks.lower_bound(ptr);
+    if (next != freeChunks.end() && ptr + size == next->first) {
+        size += next->second;
+        next = freeChunks.erase(next);
+    }
+    if (next != freeChunks.begin()) {
+        std::map<unsigned char*, size_t>::iterator prev = next;
+        --prev;
+        if (prev->first + prev->second == ptr) {
+            prev->second += size;
+            return true;
+        }
+    }
+    freeChunks[ptr] = size;
+    return true;
+}
+
+LockedPool::LockedPool()
+{
+#ifdef WIN32
+    SYSTEM_INFO sysInfo;
+    GetSystemInfo(&sysInfo);
+    pageSize = sysInfo.dwPageSize;
+#else
+    pageSize = sysconf(_SC_PAGESIZE);
+#endif
+}
+
+LockedPool& LockedPool::instance()
+{
+    //never destroyed, secure objects with static storage may outlive it otherwise
+    static LockedPool* pool = new LockedPool();
+    return *pool;
+}
+
+LockedPool::Slab* LockedPool::newSlab(size_t size)
+{
+    size = alignUp(size, pageSize);
+    size_t mapSize = size + 2 * pageSize;
+    unsigned char* mapping;
+
+#ifdef WIN32
+    mapping = (unsigned char*)VirtualAlloc(NULL, mapSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!mapping)
+        return NULL;
+    DWORD oldProtect;
+    VirtualProtect(mapping, pageSize, PAGE_NOACCESS, &oldProtect);
+    VirtualProtect(mapping + pageSize + size, pageSize, PAGE_NOACCESS, &oldProtect);
+    bool locked = VirtualLock(mapping + pageSize, size);
+#else
+    mapping = (unsigned char*)mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+        return NULL;
+    mprotect(mapping, pageSize, PROT_NONE);
+    mprotect(mapping + pageSize + size, pageSize, PROT_NONE);
+    //might fail because of RLIMIT_MEMLOCK, the memory is still usable
+    bool locked = (mlock(mapping + pageSize, size) == 0);
+#ifdef MADV_DONTDUMP
+    madvise(mapping + pageSize, size, MADV_DONTDUMP);
+#endif
+#endif
+
+    Slab* slab = new Slab();
+    slab->base = mapping + pageSize;
+    slab->size = size;
+    slab->locked = locked;
+    slab->freeChunks[slab->base] = size;
+    slabs.push_back(std::unique_ptr<Slab>(slab));
+    return slab;
+}
+
+void LockedPool::releaseSlab(Slab* slab)
+{
+    unsigned char* mapping = slab->base - pageSize;
+#ifdef WIN32
+    if (slab->locked)
+        VirtualUnlock(slab->base, slab->size);
+    VirtualFree(mapping, 0, MEM_RELEASE);
+#else
+    if (slab->locked)
+        munlock(slab->base, slab->size);
+    munmap(mapping, slab->size + 2 * pageSize);
+#endif
+
+    for (size_t i = 0; i < slabs.size(); i++)
+        if (slabs[i].get() == slab) {
+            slabs.erase(slabs.begin() + i);
+            break;
+        }
+}
+
+void* LockedPool::alloc(size_t size)
+{
+    size = alignUp(size ? size : 1, DBB_LOCKEDPOOL_ALIGNMENT);
+
+    std::lock_guard<std::mutex> lock(cs_pool);
+    for (size_t i = 0; i < slabs.size(); i++) {
+        unsigned char* ptr = slabs[i]->alloc(size);
+        if (ptr)
+            return ptr;
+    }
+
+    Slab* slab = newSlab(size > DBB_LOCKEDPOOL_SLAB_SIZE ? size : DBB_LOCKEDPOOL_SLAB_SIZE);
+    if (!slab)
+        return NULL;
+    return slab->alloc(size);
+}
+
+void LockedPool::free(void* ptr)
+{
+    if (!ptr)
+        return;
+
+    std::lock_guard<std::mutex> lock(cs_pool);
+    for (size_t i = 0; i < slabs.size(); i++) {
+        Slab* slab = slabs[i].get();
+        if (!slab->contains((unsigned char*)ptr))
+            continue;
+
+        slab->free((unsigned char*)ptr);
+        //regular slabs are kept, dedicated ones of large allocations given back
+        if (slab->size > DBB_LOCKEDPOOL_SLAB_SIZE && slab->empty())
+            releaseSlab(slab);
+        return;
+    }
+}
+
+LockedPool::Stats LockedPool::stats()
+{
+    std::lock_guard<std::mutex> lock(cs_pool);
+    Stats stats = {0, 0, 0, slabs.size()};
+    for (size_t i = 0; i < slabs.size(); i++) {
+        for (const auto& chunk : slabs[i]->usedChunks)
+            stats.used += chunk.second;
+        stats.total += slabs[i]->size;
+        if (slabs[i]->locked)
+            stats.locked += slabs[i]->size;
+    }
+    return stats;
+}
+
+void* secureAlloc(size_t size)
+{
+    return LockedPool::instance().alloc(size);
+}
+
+void secureFree(void* ptr)
+{
+    LockedPool::instance().free(ptr);
+}
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LIBDBB_SECUREMEM_H
+#define LIBDBB_SECUREMEM_H
+
+#include <stddef.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "dbb_securemem.h"
+
+namespace DBB
+{
+//!size of a pool slab, larger allocations get a slab of their own
+#define DBB_LOCKEDPOOL_SLAB_SIZE (256 * 1024)
+
+//!alignment of the pool allocations
+#define DBB_LOCKEDPOOL_ALIGNMENT 16
+
+//!pool for secrets (keys, passwords, plaintext)
+// memory is taken from a few slabs which are locked against swapping once,
+// excluded from core dumps (where supported) and surrounded by inaccessible
+// guard pages; allocations are wiped when they are released
+class LockedPool
+{
+public:
+    class Stats
+    {
+    public:
+        size_t used;   //!< bytes handed out
+        size_t total;  //!< bytes in all slabs (without guard pages)
+        size_t locked; //!< bytes locked against swapping
+        size_t slabs;
+    };
+
+    //!returns the process wide pool
+    static LockedPool& instance();
+
+    //!returns NULL if no memory could be allocated
+    void* alloc(size_t size);
+
+    //!wipe and release memory returned by alloc()
+    void free(void* ptr);
+
+    Stats stats();
+
+private:
+    class Slab
+    {
+    public:
+        unsigned char* base; //!< usable memory, the guard pages are in front and behind
+        size_t size;
+        bool locked;
+        std::map<unsigned char*, size_t> freeChunks; //!< ordered by address for coalescing
+        std::unordered_map<unsigned char*, size_t> usedChunks;
+
+        unsigned char* alloc(size_t size);
+        bool free(unsigned char* ptr);
+        bool contains(const unsigned char* ptr) const { return ptr >= base && ptr < base + size; }
+        bool empty() const { return usedChunks.empty(); }
+    };
+
+    std::mutex cs_pool;
+    std::vector<std::unique_ptr<Slab> > slabs;
+    size_t pageSize;
+
+    LockedPool();
+    LockedPool(const LockedPool&);
+    LockedPool& operator=(const LockedPool&);
+
+    Slab* newSlab(size_t size);
+    void releaseSlab(Slab* slab);
+};
+}
+
+#endif // LIBDBB_SECUREMEM_H
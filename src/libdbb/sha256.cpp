@@ -0,0 +1,407 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto.h"
+
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DBB_SHA256_X86_SIMD 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static const uint32_t sha256_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+static inline uint32_t sha256_read_be32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void sha256_write_be32(unsigned char* p, uint32_t x)
+{
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+//compress blocks consecutive 64 byte blocks into the state
+typedef void (*sha256_transform_fn)(uint32_t* s, const unsigned char* data, size_t blocks);
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_transform_generic(uint32_t* s, const unsigned char* data, size_t blocks)
+{
+    uint32_t w[64];
+    while (blocks--) {
+        for (int i = 0; i < 16; i++)
+            w[i] = sha256_read_be32(data + 4 * i);
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+            uint32_t t2 = (SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        s[0] += a;
+        s[1] += b;
+        s[2] += c;
+        s[3] += d;
+        s[4] += e;
+        s[5] += f;
+        s[6] += g;
+        s[7] += h;
+        data += 64;
+    }
+    memoryCleanse(w, sizeof(w));
+}
+
+#ifdef DBB_SHA256_X86_SIMD
+//SHA-NI, four rounds per quad of message words; the state is kept as ABEF/CDGH
+__attribute__((target("sha,sse4.1"))) static void sha256_transform_shani(uint32_t* s, const unsigned char* data, size_t blocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&s[0]), 0xB1); //CDAB
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&s[4]), 0x1B); //EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); //ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0); //CDGH
+
+    while (blocks--) {
+        __m128i abef = state0;
+        __m128i cdgh = state1;
+        __m128i w[4];
+        for (int i = 0; i < 16; i++) {
+            if (i < 4)
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * i)), mask);
+            else {
+                //w[i & 3] holds the words of quad i - 4, w[(i + 3) & 3] the ones of quad i - 1
+                __m128i next = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                next = _mm_add_epi32(next, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+                w[i & 3] = _mm_sha256msg2_epu32(next, w[(i + 3) & 3]);
+            }
+            __m128i msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i*)&sha256_k[4 * i]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+        }
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+        data += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B); //FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1); //DCHG
+    _mm_storeu_si128((__m128i*)&s[0], _mm_blend_epi16(tmp, state1, 0xF0)); //DCBA
+    _mm_storeu_si128((__m128i*)&s[4], _mm_alignr_epi8(state1, tmp, 8)); //HGFE
+}
+
+//AVX2, one block of eight independent messages per call
+//state is transposed: state[word][lane]
+#define SHA256_ROTR8(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+__attribute__((target("avx2"))) static void sha256_transform_8way(uint32_t state[8][8], const unsigned char* const blocks[8])
+{
+    __m256i w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = _mm256_set_epi32(sha256_read_be32(blocks[7] + 4 * i), sha256_read_be32(blocks[6] + 4 * i),
+                                sha256_read_be32(blocks[5] + 4 * i), sha256_read_be32(blocks[4] + 4 * i),
+                                sha256_read_be32(blocks[3] + 4 * i), sha256_read_be32(blocks[2] + 4 * i),
+                                sha256_read_be32(blocks[1] + 4 * i), sha256_read_be32(blocks[0] + 4 * i));
+    for (int i = 16; i < 64; i++) {
+        __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(SHA256_ROTR8(w[i - 15], 7), SHA256_ROTR8(w[i - 15], 18)), _mm256_srli_epi32(w[i - 15], 3));
+        __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(SHA256_ROTR8(w[i - 2], 17), SHA256_ROTR8(w[i - 2], 19)), _mm256_srli_epi32(w[i - 2], 10));
+        w[i] = _mm256_add_epi32(_mm256_add_epi32(w[i - 16], s0), _mm256_add_epi32(w[i - 7], s1));
+    }
+
+    __m256i a = _mm256_loadu_si256((const __m256i*)state[0]);
+    __m256i b = _mm256_loadu_si256((const __m256i*)state[1]);
+    __m256i c = _mm256_loadu_si256((const __m256i*)state[2]);
+    __m256i d = _mm256_loadu_si256((const __m256i*)state[3]);
+    __m256i e = _mm256_loadu_si256((const __m256i*)state[4]);
+    __m256i f = _mm256_loadu_si256((const __m256i*)state[5]);
+    __m256i g = _mm256_loadu_si256((const __m256i*)state[6]);
+    __m256i h = _mm256_loadu_si256((const __m256i*)state[7]);
+    for (int i = 0; i < 64; i++) {
+        __m256i sigma1 = _mm256_xor_si256(_mm256_xor_si256(SHA256_ROTR8(e, 6), SHA256_ROTR8(e, 11)), SHA256_ROTR8(e, 25));
+        __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, sigma1), _mm256_add_epi32(ch, _mm256_add_epi32(_mm256_set1_epi32(sha256_k[i]), w[i])));
+        __m256i sigma0 = _mm256_xor_si256(_mm256_xor_si256(SHA256_ROTR8(a, 2), SHA256_ROTR8(a, 13)), SHA256_ROTR8(a, 22));
+        __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32(t1, _mm256_add_epi32(sigma0, maj));
+    }
+
+    __m256i* out = (__m256i*)state;
+    _mm256_storeu_si256(&out[0], _mm256_add_epi32(_mm256_loadu_si256(&out[0]), a));
+    _mm256_storeu_si256(&out[1], _mm256_add_epi32(_mm256_loadu_si256(&out[1]), b));
+    _mm256_storeu_si256(&out[2], _mm256_add_epi32(_mm256_loadu_si256(&out[2]), c));
+    _mm256_storeu_si256(&out[3], _mm256_add_epi32(_mm256_loadu_si256(&out[3]), d));
+    _mm256_storeu_si256(&out[4], _mm256_add_epi32(_mm256_loadu_si256(&out[4]), e));
+    _mm256_storeu_si256(&out[5], _mm256_add_epi32(_mm256_loadu_si256(&out[5]), f));
+    _mm256_storeu_si256(&out[6], _mm256_add_epi32(_mm256_loadu_si256(&out[6]), g));
+    _mm256_storeu_si256(&out[7], _mm256_add_epi32(_mm256_loadu_si256(&out[7]), h));
+}
+
+static bool sha256_cpu_has_shani()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1))
+        return false;
+    if (__get_cpuid_max(0, NULL) < 7)
+        return false;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1 << 29)) != 0;
+}
+
+static bool sha256_cpu_has_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+//the implementation is chosen once, the fastest one of the CPU unless overridden
+class SHA256Dispatch
+{
+public:
+    sha256_transform_fn transform;
+    bool multiBuffer; //hash batches over the AVX2 8-way kernel
+    const char* name;
+
+    SHA256Dispatch() : transform(sha256_transform_generic), multiBuffer(false), name("generic")
+    {
+        //one SHA-NI stream beats eight AVX2 lanes, no multi-buffer if present
+        if (!select("shani"))
+            select("avx2");
+    }
+
+    bool select(const char* nameIn)
+    {
+        if (strcmp(nameIn, "generic") == 0) {
+            transform = sha256_transform_generic;
+            multiBuffer = false;
+            name = "generic";
+            return true;
+        }
+#ifdef DBB_SHA256_X86_SIMD
+        if (strcmp(nameIn, "shani") == 0 && sha256_cpu_has_shani()) {
+            transform = sha256_transform_shani;
+            multiBuffer = false;
+            name = "shani";
+            return true;
+        }
+        if (strcmp(nameIn, "avx2") == 0 && sha256_cpu_has_avx2()) {
+            transform = sha256_transform_generic;
+            multiBuffer = true;
+            name = "avx2";
+            return true;
+        }
+#endif
+        return false;
+    }
+};
+
+static SHA256Dispatch& sha256_dispatch()
+{
+    static SHA256Dispatch dispatch;
+    return dispatch;
+}
+
+const char* sha256_implementation()
+{
+    return sha256_dispatch().name;
+}
+
+bool sha256_select_implementation(const char* name)
+{
+    return sha256_dispatch().select(name);
+}
+
+//copy the last len % 64 bytes of a message of len bytes (last) into tail (room
+//for 128 bytes) and append the padding, returns the amount of tail blocks
+static size_t sha256_pad(const unsigned char* last, size_t len, unsigned char* tail)
+{
+    size_t rem = len % 64;
+    size_t tailLen = (rem + 9 <= 64) ? 64 : 128;
+    memcpy(tail, last, rem);
+    tail[rem] = 0x80;
+    memset(tail + rem + 1, 0, tailLen - rem - 1 - 8);
+    uint64_t bits = (uint64_t)len << 3;
+    sha256_write_be32(tail + tailLen - 8, (uint32_t)(bits >> 32));
+    sha256_write_be32(tail + tailLen - 4, (uint32_t)bits);
+    return tailLen / 64;
+}
+
+SHA256Hasher::SHA256Hasher()
+{
+    reset();
+}
+
+SHA256Hasher::~SHA256Hasher()
+{
+    memoryCleanse(s, sizeof(s));
+    memoryCleanse(buf, sizeof(buf));
+}
+
+void SHA256Hasher::reset()
+{
+    memcpy(s, sha256_iv, sizeof(s));
+    bytes = 0;
+}
+
+SHA256Hasher& SHA256Hasher::write(const unsigned char* data, size_t len)
+{
+    sha256_transform_fn transform = sha256_dispatch().transform;
+    size_t bufLen = bytes % 64;
+    bytes += len;
+    if (bufLen && bufLen + len >= 64) {
+        memcpy(buf + bufLen, data, 64 - bufLen);
+        data += 64 - bufLen;
+        len -= 64 - bufLen;
+        transform(s, buf, 1);
+        bufLen = 0;
+    }
+    if (len >= 64) {
+        transform(s, data, len / 64);
+        data += len & ~(size_t)63;
+        len %= 64;
+    }
+    memcpy(buf + bufLen, data, len);
+    return *this;
+}
+
+void SHA256Hasher::finalize(unsigned char* hashOut)
+{
+    unsigned char tail[128];
+    size_t tailBlocks = sha256_pad(buf, bytes, tail);
+    sha256_dispatch().transform(s, tail, tailBlocks);
+    for (int i = 0; i < 8; i++)
+        sha256_write_be32(hashOut + 4 * i, s[i]);
+    memoryCleanse(tail, sizeof(tail));
+    reset();
+}
+
+void sha256(const unsigned char* data, size_t len, unsigned char* hashOut)
+{
+    SHA256Hasher().write(data, len).finalize(hashOut);
+}
+
+#ifdef DBB_SHA256_X86_SIMD
+//a message in a lane of the 8-way kernel
+class SHA256Lane
+{
+public:
+    size_t msg; //index of the message
+    const unsigned char* data;
+    size_t fullBlocks;
+    size_t blocks; //full blocks + tail blocks
+    size_t next;
+    unsigned char tail[128];
+
+    void start(size_t msgIn, const unsigned char* dataIn, size_t len)
+    {
+        msg = msgIn;
+        data = dataIn;
+        fullBlocks = len / 64;
+        blocks = fullBlocks + sha256_pad(dataIn + 64 * fullBlocks, len, tail);
+        next = 0;
+    }
+
+    const unsigned char* block() const
+    {
+        return next < fullBlocks ? data + 64 * next : tail + 64 * (next - fullBlocks);
+    }
+};
+
+//hash the messages eight at a time, a lane whose message is done takes the
+//next one so messages of different lengths keep all lanes busy
+static void sha256_many_8way(const unsigned char* const* data, const size_t* lens, size_t count, unsigned char* hashesOut)
+{
+    static const unsigned char idleBlock[64] = {0};
+    uint32_t state[8][8];
+    SHA256Lane lanes[8];
+    bool active[8];
+    const unsigned char* blocks[8];
+    size_t nextMsg = 0;
+    size_t nActive = 0;
+
+    for (int lane = 0; lane < 8; lane++) {
+        active[lane] = nextMsg < count;
+        if (!active[lane])
+            continue;
+        lanes[lane].start(nextMsg, data[nextMsg], lens[nextMsg]);
+        nextMsg++;
+        nActive++;
+        for (int i = 0; i < 8; i++)
+            state[i][lane] = sha256_iv[i];
+    }
+
+    while (nActive > 0) {
+        for (int lane = 0; lane < 8; lane++)
+            blocks[lane] = active[lane] ? lanes[lane].block() : idleBlock;
+        sha256_transform_8way(state, blocks);
+
+        for (int lane = 0; lane < 8; lane++) {
+            if (!active[lane] || ++lanes[lane].next < lanes[lane].blocks)
+                continue;
+            for (int i = 0; i < 8; i++)
+                sha256_write_be32(hashesOut + lanes[lane].msg * DBB_SHA256_DIGEST_LENGTH + 4 * i, state[i][lane]);
+            if (nextMsg < count) {
+                lanes[lane].start(nextMsg, data[nextMsg], lens[nextMsg]);
+                nextMsg++;
+                for (int i = 0; i < 8; i++)
+                    state[i][lane] = sha256_iv[i];
+            } else {
+                active[lane] = false;
+                nActive--;
+            }
+        }
+    }
+    memoryCleanse(state, sizeof(state));
+    memoryCleanse(lanes, sizeof(lanes));
+}
+#endif
+
+void sha256_many(const unsigned char* const* data, const size_t* lens, size_t count, unsigned char* hashesOut)
+{
+#ifdef DBB_SHA256_X86_SIMD
+    //a few messages are faster one by one
+    if (sha256_dispatch().multiBuffer && count >= DBB_SHA256_MULTIBUFFER_MIN) {
+        sha256_many_8way(data, lens, count, hashesOut);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; i++)
+        sha256(data[i], lens[i], hashesOut + i * DBB_SHA256_DIGEST_LENGTH);
+}
@@ -0,0 +1,191 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LIBDBB_TRANSPORT_H
+#define LIBDBB_TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define HID_REPORT_SIZE 2048
+#define DBB_USB_VENDOR_ID 0x03eb
+#define DBB_USB_PRODUCT_ID 0x2402
+#define DBB_CAPTURE_MAGIC "DBBCAP01"
+
+struct hid_device_;
+
+namespace DBB
+{
+//!abstract device transport
+// a Connection dispatches the commands through it
+class Transport
+{
+public:
+    virtual ~Transport() {}
+
+    //!open the device with the given path, an empty path opens the first available device
+    virtual bool open(const std::string& path = "") = 0;
+
+    //!close the device, returns false if no device was open
+    virtual bool close() = 0;
+
+    //!returns true if the transport has an open device handle
+    virtual bool isOpen() const = 0;
+
+    //!write a report, returns the amount of bytes written or -1 in case of an error
+    virtual int write(const unsigned char* data, size_t len) = 0;
+
+    //!read up to len bytes, returns the amount of bytes read or -1 in case of an error
+    // timeoutMS = -1 blocks until data is available
+    virtual int read(unsigned char* data, size_t len, int timeoutMS = -1) = 0;
+
+    //!returns the paths of all available devices
+    virtual std::vector<std::string> enumerate() = 0;
+};
+
+//!transport over a USB HID device (hidapi)
+class HIDTransport : public Transport
+{
+public:
+    HIDTransport();
+    ~HIDTransport();
+
+    bool open(const std::string& path = "");
+    bool close();
+    bool isOpen() const;
+    int write(const unsigned char* data, size_t len);
+    int read(unsigned char* data, size_t len, int timeoutMS = -1);
+    std::vector<std::string> enumerate();
+
+private:
+    struct hid_device_* handle;
+};
+
+//!in-process transport without any USB I/O
+// every written report is passed to the responder, the returned string is
+// served (zero padded to reportSize) to the following reads; in chunked
+// mode requests are collected until a report contains the NUL terminator
+// and responses are served over as many reports as needed; responses are
+// queued in request order and survive closing and reopening the transport
+class LoopbackTransport : public Transport
+{
+public:
+    typedef std::function<std::string(const std::string& request)> Responder;
+
+    //!the default responder echos the request like a device with the same
+    // password would do (plain json is returned as it is, ciphertexts are
+    // wrapped into {"ciphertext":"..."})
+    static std::string EchoResponder(const std::string& request);
+
+    LoopbackTransport(const Responder& responderIn = EchoResponder, size_t reportSizeIn = HID_REPORT_SIZE, bool chunkedIn = false);
+
+    //!delay the responses to the following requests by delayMS milliseconds
+    // (a slow device), reads honour their timeout while waiting for them
+    void setResponseDelay(int delayMS);
+
+    bool open(const std::string& path = "");
+    bool close();
+    bool isOpen() const;
+    int write(const unsigned char* data, size_t len);
+    int read(unsigned char* data, size_t len, int timeoutMS = -1);
+    std::vector<std::string> enumerate();
+
+private:
+    class Response
+    {
+    public:
+        std::string data;
+        size_t end; //!< data plus the zero padding of the last report
+        std::chrono::steady_clock::time_point readyAt;
+    };
+
+    Responder responder;
+    size_t reportSize;
+    bool chunked;
+    bool opened;
+    int responseDelay;
+    std::string pendingRequest;
+    std::deque<Response> responses;
+    size_t readPos; //!< read position in the first queued response
+};
+
+//!records every report written to and read from another transport
+// capture files start with DBB_CAPTURE_MAGIC followed by one record per
+// report: direction (1 byte, 'W' or 'R'), microseconds since the capture
+// started (8 bytes), report length (4 bytes), stored length (4 bytes) and
+// the stored bytes; trailing zero padding is not stored. Payloads are
+// captured as they go over the wire (encrypted commands stay encrypted).
+class CaptureTransport : public Transport
+{
+public:
+    CaptureTransport(const std::shared_ptr<Transport>& innerIn, FILE* fileIn);
+    ~CaptureTransport();
+
+    //!create a capture file, returns NULL if the file could not be opened
+    static CaptureTransport* create(const std::shared_ptr<Transport>& innerIn, const std::string& filename);
+
+    //!returns the captured transport
+    std::shared_ptr<Transport> getInner() const { return inner; }
+
+    bool open(const std::string& path = "");
+    bool close();
+    bool isOpen() const;
+    int write(const unsigned char* data, size_t len);
+    int read(unsigned char* data, size_t len, int timeoutMS = -1);
+    std::vector<std::string> enumerate();
+
+private:
+    std::shared_ptr<Transport> inner;
+    FILE* file;
+    std::chrono::steady_clock::time_point startTime;
+
+    void writeRecord(char direction, const std::chrono::steady_clock::time_point& time, const unsigned char* data, size_t len);
+};
+
+//!plays back a capture file instead of talking to a device
+// writes consume the next recorded request, reads serve the recorded
+// responses delayed like in the captured session divided by speed
+// (speed <= 0 serves them without any delay)
+class ReplayTransport : public Transport
+{
+public:
+    ReplayTransport(const std::string& filenameIn, double speedIn = 1.0);
+
+    //!load the capture file, returns false if it could not be read
+    bool open(const std::string& path = "");
+    bool close();
+    bool isOpen() const;
+    int write(const unsigned char* data, size_t len);
+    int read(unsigned char* data, size_t len, int timeoutMS = -1);
+    std::vector<std::string> enumerate();
+
+private:
+    class Record
+    {
+    public:
+        char direction;
+        uint64_t timestamp;
+        uint32_t reportLen;
+        std::string data;
+    };
+
+    std::string filename;
+    double speed;
+    bool opened;
+    std::vector<Record> records;
+    size_t pos;
+    size_t recordPos; //!< bytes of records[pos] served by previous reads
+    uint64_t lastWriteTimestamp;
+    std::chrono::steady_clock::time_point lastWriteTime;
+};
+}
+#endif // LIBDBB_TRANSPORT_H
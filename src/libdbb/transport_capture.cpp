@@ -0,0 +1,225 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "transport.h"
+
+#include <string.h>
+
+#include <thread>
+
+namespace DBB
+{
+static void writeLE(FILE* file, uint64_t value, int bytes)
+{
+    unsigned char buf[8];
+    for (int i = 0; i < bytes; i++)
+        buf[i] = (value >> (8 * i)) & 0xff;
+    fwrite(buf, 1, bytes, file);
+}
+
+static bool readLE(FILE* file, uint64_t& value, int bytes)
+{
+    unsigned char buf[8];
+    if (fread(buf, 1, bytes, file) != (size_t)bytes)
+        return false;
+    value = 0;
+    for (int i = 0; i < bytes; i++)
+        value |= (uint64_t)buf[i] << (8 * i);
+    return true;
+}
+
+CaptureTransport::CaptureTransport(const std::shared_ptr<Transport>& innerIn, FILE* fileIn) : inner(innerIn), file(fileIn), startTime(std::chrono::steady_clock::now())
+{
+}
+
+CaptureTransport::~CaptureTransport()
+{
+    if (file)
+        fclose(file);
+}
+
+CaptureTransport* CaptureTransport::create(const std::shared_ptr<Transport>& innerIn, const std::string& filename)
+{
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (!file)
+        return NULL;
+
+    fwrite(DBB_CAPTURE_MAGIC, 1, strlen(DBB_CAPTURE_MAGIC), file);
+    return new CaptureTransport(innerIn, file);
+}
+
+void CaptureTransport::writeRecord(char direction, const std::chrono::steady_clock::time_point& time, const unsigned char* data, size_t len)
+{
+    //strip the report padding
+    size_t storedLen = len;
+    while (storedLen > 0 && data[storedLen - 1] == 0)
+        storedLen--;
+
+    uint64_t timestamp = std::chrono::duration_cast<std::chrono::microseconds>(time - startTime).count();
+    fputc(direction, file);
+    writeLE(file, timestamp, 8);
+    writeLE(file, len, 4);
+    writeLE(file, storedLen, 4);
+    fwrite(data, 1, storedLen, file);
+    fflush(file);
+}
+
+bool CaptureTransport::open(const std::string& path)
+{
+    return inner->open(path);
+}
+
+bool CaptureTransport::close()
+{
+    return inner->close();
+}
+
+bool CaptureTransport::isOpen() const
+{
+    return inner->isOpen();
+}
+
+int CaptureTransport::write(const unsigned char* data, size_t len)
+{
+    //requests are stamped when they are sent, responses when they arrived
+    std::chrono::steady_clock::time_point time = std::chrono::steady_clock::now();
+    int res = inner->write(data, len);
+    if (res > 0)
+        writeRecord('W', time, data, res);
+    return res;
+}
+
+int CaptureTransport::read(unsigned char* data, size_t len, int timeoutMS)
+{
+    int res = inner->read(data, len, timeoutMS);
+    if (res > 0)
+        writeRecord('R', std::chrono::steady_clock::now(), data, res);
+    return res;
+}
+
+std::vector<std::string> CaptureTransport::enumerate()
+{
+    return inner->enumerate();
+}
+
+ReplayTransport::ReplayTransport(const std::string& filenameIn, double speedIn) : filename(filenameIn), speed(speedIn), opened(false), pos(0), recordPos(0), lastWriteTimestamp(0)
+{
+}
+
+bool ReplayTransport::open(const std::string&)
+{
+    records.clear();
+    pos = recordPos = 0;
+    opened = false;
+
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (!file)
+        return false;
+
+    char magic[sizeof(DBB_CAPTURE_MAGIC) - 1];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, DBB_CAPTURE_MAGIC, sizeof(magic)) != 0) {
+        fclose(file);
+        return false;
+    }
+
+    int direction;
+    while ((direction = fgetc(file)) != EOF) {
+        Record record;
+        uint64_t timestamp, reportLen, storedLen;
+        if (!readLE(file, timestamp, 8) || !readLE(file, reportLen, 4) || !readLE(file, storedLen, 4) || storedLen > reportLen)
+            break;
+
+        record.direction = (char)direction;
+        record.timestamp = timestamp;
+        record.reportLen = reportLen;
+        record.data.resize(storedLen);
+        if (storedLen > 0 && fread(&record.data[0], 1, storedLen, file) != storedLen)
+            break;
+        records.push_back(record);
+    }
+    fclose(file);
+
+    opened = true;
+    return true;
+}
+
+bool ReplayTransport::close()
+{
+    if (!opened)
+        return false;
+
+    opened = false;
+    return true;
+}
+
+bool ReplayTransport::isOpen() const
+{
+    return opened;
+}
+
+int ReplayTransport::write(const unsigned char*, size_t len)
+{
+    if (!opened)
+        return -1;
+
+    //the request itself is not compared, encrypted requests use a random IV
+    while (pos < records.size() && records[pos].direction != 'W')
+        pos++;
+    if (pos >= records.size())
+        return -1;
+
+    lastWriteTimestamp = records[pos].timestamp;
+    lastWriteTime = std::chrono::steady_clock::now();
+    pos++;
+    recordPos = 0;
+    return (int)len;
+}
+
+int ReplayTransport::read(unsigned char* data, size_t len, int timeoutMS)
+{
+    //nothing left to read would block forever on a real device
+    if (!opened || pos >= records.size() || records[pos].direction != 'R')
+        return -1;
+
+    //the remainder of a partially read record is served without a delay
+    const Record& record = records[pos];
+    if (speed > 0 && recordPos == 0) {
+        std::chrono::steady_clock::time_point due = lastWriteTime + std::chrono::microseconds((uint64_t)((record.timestamp - lastWriteTimestamp) / speed));
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (timeoutMS >= 0 && due > now + std::chrono::milliseconds(timeoutMS)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMS));
+            return 0;
+        }
+        std::this_thread::sleep_until(due);
+    }
+
+    size_t toRead = record.reportLen - recordPos;
+    if (toRead > len)
+        toRead = len;
+    size_t fromRecord = 0;
+    if (recordPos < record.data.size()) {
+        fromRecord = record.data.size() - recordPos;
+        if (fromRecord > toRead)
+            fromRecord = toRead;
+        memcpy(data, record.data.data() + recordPos, fromRecord);
+    }
+    memset(data + fromRecord, 0, toRead - fromRecord);
+    recordPos += toRead;
+
+    //a record is done once the whole report was read
+    if (recordPos >= record.reportLen) {
+        pos++;
+        recordPos = 0;
+    }
+
+    return (int)toRead;
+}
+
+std::vector<std::string> ReplayTransport::enumerate()
+{
+    std::vector<std::string> paths;
+    paths.push_back(filename);
+    return paths;
+}
+}
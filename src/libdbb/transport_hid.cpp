@@ -0,0 +1,77 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "transport.h"
+
+#include "hidapi/hidapi.h"
+
+namespace DBB
+{
+HIDTransport::HIDTransport() : handle(NULL)
+{
+}
+
+HIDTransport::~HIDTransport()
+{
+    close();
+}
+
+bool HIDTransport::open(const std::string& path)
+{
+    close();
+
+    if (path.empty())
+        handle = hid_open(DBB_USB_VENDOR_ID, DBB_USB_PRODUCT_ID, NULL);
+    else
+        handle = hid_open_path(path.c_str());
+
+    return (handle != NULL);
+}
+
+bool HIDTransport::close()
+{
+    if (!handle)
+        return false;
+
+    hid_close(handle);
+    handle = NULL;
+    return true;
+}
+
+bool HIDTransport::isOpen() const
+{
+    return (handle != NULL);
+}
+
+int HIDTransport::write(const unsigned char* data, size_t len)
+{
+    if (!handle)
+        return -1;
+
+    return hid_write(handle, data, len);
+}
+
+int HIDTransport::read(unsigned char* data, size_t len, int timeoutMS)
+{
+    if (!handle)
+        return -1;
+
+    return hid_read_timeout(handle, data, len, timeoutMS);
+}
+
+std::vector<std::string> HIDTransport::enumerate()
+{
+    std::vector<std::string> paths;
+    struct hid_device_info* devs, *cur_dev;
+
+    devs = hid_enumerate(DBB_USB_VENDOR_ID, DBB_USB_PRODUCT_ID);
+    for (cur_dev = devs; cur_dev; cur_dev = cur_dev->next) {
+        if (cur_dev->path)
+            paths.push_back(std::string(cur_dev->path));
+    }
+    hid_free_enumeration(devs);
+
+    return paths;
+}
+}
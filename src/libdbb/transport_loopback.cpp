@@ -0,0 +1,131 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "transport.h"
+
+#include <string.h>
+
+#include <thread>
+
+namespace DBB
+{
+std::string LoopbackTransport::EchoResponder(const std::string& request)
+{
+    if (!request.empty() && request[0] == '{')
+        return request;
+
+    return "{\"ciphertext\":\"" + request + "\"}";
+}
+
+LoopbackTransport::LoopbackTransport(const Responder& responderIn, size_t reportSizeIn, bool chunkedIn) : responder(responderIn), reportSize(reportSizeIn), chunked(chunkedIn), opened(false), responseDelay(0), readPos(0)
+{
+}
+
+void LoopbackTransport::setResponseDelay(int delayMS)
+{
+    responseDelay = delayMS;
+}
+
+bool LoopbackTransport::open(const std::string&)
+{
+    //like a device, reopening keeps the responses that are still on their way
+    opened = true;
+    return true;
+}
+
+bool LoopbackTransport::close()
+{
+    if (!opened)
+        return false;
+
+    opened = false;
+    return true;
+}
+
+bool LoopbackTransport::isOpen() const
+{
+    return opened;
+}
+
+int LoopbackTransport::write(const unsigned char* data, size_t len)
+{
+    if (!opened)
+        return -1;
+
+    //reports are zero padded, the request ends at the first NUL byte
+    const char* request = (const char*)data;
+    size_t requestLen = strnlen(request, len);
+    pendingRequest.append(request, requestLen);
+
+    //a chunked request continues in the next report until it is terminated
+    if (chunked && requestLen == len)
+        return (int)len;
+
+    Response response;
+    response.data = responder(pendingRequest);
+    pendingRequest.clear();
+    if (chunked)
+        response.end = (response.data.size() / reportSize + 1) * reportSize;
+    else {
+        if (response.data.size() > reportSize)
+            response.data.resize(reportSize);
+        response.end = reportSize;
+    }
+    response.readyAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(responseDelay);
+    responses.push_back(response);
+
+    return (int)len;
+}
+
+int LoopbackTransport::read(unsigned char* data, size_t len, int timeoutMS)
+{
+    if (!opened)
+        return -1;
+
+    //nothing to read would block forever on a real device
+    if (responses.empty()) {
+        if (timeoutMS < 0)
+            return -1;
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMS));
+        return 0;
+    }
+
+    const Response& response = responses.front();
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (timeoutMS >= 0 && response.readyAt > now + std::chrono::milliseconds(timeoutMS)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMS));
+        return 0;
+    }
+    std::this_thread::sleep_until(response.readyAt);
+
+    //a read never crosses a report boundary
+    size_t toRead = reportSize - readPos % reportSize;
+    if (toRead > len)
+        toRead = len;
+
+    size_t fromResponse = 0;
+    if (readPos < response.data.size()) {
+        fromResponse = response.data.size() - readPos;
+        if (fromResponse > toRead)
+            fromResponse = toRead;
+        memcpy(data, response.data.data() + readPos, fromResponse);
+    }
+    memset(data + fromResponse, 0, toRead - fromResponse);
+    readPos += toRead;
+
+    if (readPos >= response.end) {
+        responses.pop_front();
+        readPos = 0;
+    }
+
+    return (int)toRead;
+}
+
+std::vector<std::string> LoopbackTransport::enumerate()
+{
+    std::vector<std::string> paths;
+    paths.push_back("loopback");
+    return paths;
+}
+}
@@ -19,13 +19,11 @@
 #include "pubkey.h"
 #include "base58.h"
 
-#include "univalue/univalue.h"
+#include "univalue.h"
 
 #include <functional>
 
-void executeCommand(const std::string& cmd, const std::string& password, std::function<void(const std::string&, dbb_cmd_execution_status_t status)> cmdFinished);
-
-bool DBBDaemonGui::QTexecuteCommandWrapper(const std::string& cmd, const dbb_process_infolayer_style_t layerstyle, std::function<void(const std::string&, dbb_cmd_execution_status_t status)> cmdFinished) {
+bool DBBDaemonGui::QTexecuteCommandWrapper(const DBB::SecureString& cmd, const dbb_process_infolayer_style_t layerstyle, std::function<void(const UniValue&, dbb_cmd_execution_status_t status)> cmdFinished) {
 
     if (processComnand)
         return false;
@@ -37,7 +35,8 @@ bool DBBDaemonGui::QTexecuteCommandWrapper(const std::string& cmd, const dbb_pro
 
     setLoading(true);
     processComnand = true;
-    executeCommand(cmd, sessionPassword, cmdFinished);
+    int timeoutMS = (layerstyle == DBB_PROCESS_INFOLAYER_STYLE_TOUCHBUTTON) ? DBB_APP_TOUCHBUTTON_COMMAND_TIMEOUT_MS : DBB_APP_COMMAND_TIMEOUT_MS;
+    currentCommandToken = executeCommand(cmd, sessionKey, cmdFinished, timeoutMS);
 
     return true;
 }
@@ -72,6 +71,8 @@ DBBDaemonGui::DBBDaemonGui(QWidget* parent) : QMainWindow(parent),
     connect(this, SIGNAL(gotResponse(const UniValue&, dbb_cmd_execution_status_t, dbb_response_type_t)), this, SLOT(parseResponse(const UniValue&, dbb_cmd_execution_status_t, dbb_response_type_t)));
     connect(this, SIGNAL(shouldVerifySigning(const QString&)), this, SLOT(showEchoVerification(const QString&)));
     connect(this, SIGNAL(signedProposalAvailable(const UniValue&, const std::vector<std::string> &)), this, SLOT(postSignedPaymentProposal(const UniValue&, const std::vector<std::string> &)));
+    connect(this, SIGNAL(signedProposalInvalid()), this, SLOT(showInvalidSignatures()));
+    connect(this, SIGNAL(signedProposalMalformed()), this, SLOT(showMalformedSignResponse()));
 
     //set window icon
     QApplication::setWindowIcon(QIcon(":/icons/dbb"));
@@ -155,7 +156,9 @@ void DBBDaemonGui::askForSessionPassword()
     bool ok;
     QString text = QInputDialog::getText(this, tr("Start Session"), tr("Current Password"), QLineEdit::Normal, "", &ok);
     if (ok && !text.isEmpty()) {
-        sessionPassword = text.toStdString();
+        QByteArray utf8 = text.toUtf8();
+        sessionKey.reset(new DBB::SessionKey(DBB::SecureString(utf8.constData(), utf8.size())));
+        utf8.fill(0);
     }
 }
 
@@ -197,106 +200,121 @@ bool DBBDaemonGui::checkPaymentProposals()
                                  QMessageBox::Ok);
     }
 
-    UniValue response;
-    if (response.read(walletsResponse)) {
-        if (response.isObject()) {
-            printf("Wallet: %s\n", response.write(true, 2).c_str());
-
-            std::string currentXPub = vMultisigWallets[0].client.GetXPubKey();
-            UniValue wallet = find_value(response, "wallet");
-            UniValue copayers = find_value(wallet, "copayers");
-            for (const UniValue& copayer : copayers.getValues()) {
-                UniValue copayerXPub = find_value(copayer, "xPubKey");
-                if (!copayerXPub.isNull()) {
-                    if (currentXPub == copayerXPub.get_str()) {
-                        UniValue addressManager = find_value(copayer, "addressManager");
-                        UniValue copayerIndexObject = find_value(addressManager, "copayerIndex");
-                        copayerIndex = copayerIndexObject.get_int();
-                    }
-                }
+    //only the pending proposals get parsed into UniValues, the rest of the wallet status is skipped
+    UniValue pendingTxps;
+    if (vMultisigWallets[0].client.ParseWalletStatus(walletsResponse, copayerIndex, pendingTxps)) {
+        printf("Wallet: %s\n", walletsResponse.c_str());
+
+        if (pendingTxps.isArray()) {
+            printf("pending txps: %s", pendingTxps.write(2, 2).c_str());
+            if (pendingTxps.size() == 0)
+                return false;
+
+            //the command finishes asynchronously, keep a copy of the proposal only
+            UniValue proposal = pendingTxps[0];
+
+            bool ok;
+
+            QString amount;
+            QString toAddress;
+
+            const UniValue& toAddressUni = find_value(proposal, "toAddress");
+            const UniValue& amountUni = find_value(proposal, "amount");
+            if (toAddressUni.isStr())
+                toAddress = QString::fromStdString(toAddressUni.get_str());
+            if (amountUni.isNum())
+                amount = QString::number(((double)amountUni.get_int64()/100000000.0));
+
+            QMessageBox::StandardButton reply = QMessageBox::question(this, tr("Payment Proposal Available"), tr("Do you want to sign: pay %1BTC to %2").arg(amount, toAddress), QMessageBox::Yes|QMessageBox::No);
+            if (reply == QMessageBox::No)
+                return false;
+
+            std::vector<std::pair<std::string, uint256> > inputHashesAndPaths;
+            vMultisigWallets[0].client.ParseTxProposal(proposal, inputHashesAndPaths);
+            if (inputHashesAndPaths.empty())
+                return false;
+
+            //sign all inputs at once
+            std::string hashesAndPaths;
+            for (const std::pair<std::string, uint256>& hashAndPath : inputHashesAndPaths) {
+                if (!hashesAndPaths.empty())
+                    hashesAndPaths += ", ";
+                hashesAndPaths += "{ \"hash\" : \"" + BitPayWalletClient::ReversePairs(hashAndPath.second.GetHex()) + "\", \"keypath\" : \"" + vMultisigWallets[0].baseKeyPath + "/45'/" + hashAndPath.first + "\" }";
             }
+            std::string command = "{\"sign\": { \"type\": \"meta\", \"meta\" : \"somedata\", \"data\" : [ " + hashesAndPaths + " ] } }";
+            printf("Command: %s\n", command.c_str());
+
+            //signing waits for the touchbutton
+            QTexecuteCommandWrapper(DBB::SecureString(command.begin(), command.end()), DBB_PROCESS_INFOLAYER_STYLE_TOUCHBUTTON, [&ret, proposal, inputHashesAndPaths, this](const UniValue& jsonOut, dbb_cmd_execution_status_t status) {
+                //send a signal to the main thread, it resets the touchbutton layer and reports timeouts and device errors
+                emit gotResponse(jsonOut, status, DBB_RESPONSE_TYPE_SIGN);
+                printf("cmd back: %s\n", jsonOut.write().c_str());
+                
+                const UniValue& echoStr = find_value(jsonOut, "echo");
+                if (!echoStr.isNull() && echoStr.isStr())
+                {
 
-            UniValue pendingTxps;
-            pendingTxps = find_value(response, "pendingTxps");
-            if (!pendingTxps.isNull() && pendingTxps.isArray()) {
-                printf("pending txps: %s", pendingTxps.write(2, 2).c_str());
-                std::vector<UniValue> values = pendingTxps.getValues();
-                if (values.size() == 0)
-                    return false;
-
-                bool ok;
-
-                QString amount;
-                QString toAddress;
-
-                UniValue toAddressUni = find_value(values[0], "toAddress");
-                UniValue amountUni = find_value(values[0], "amount");
-                if (toAddressUni.isStr())
-                    toAddress = QString::fromStdString(toAddressUni.get_str());
-                if (amountUni.isNum())
-                    amount = QString::number(((double)amountUni.get_int64()/100000000.0));
-
-                QMessageBox::StandardButton reply = QMessageBox::question(this, tr("Payment Proposal Available"), tr("Do you want to sign: pay %1BTC to %2").arg(amount, toAddress), QMessageBox::Yes|QMessageBox::No);
-                if (reply == QMessageBox::No)
-                    return false;
-
-                std::vector<std::pair<std::string, uint256> > inputHashesAndPaths;
-                vMultisigWallets[0].client.ParseTxProposal(values[0], inputHashesAndPaths);
-
-                std::string command = "{\"sign\": { \"type\": \"hash\", \"data\" : \"" + BitPayWalletClient::ReversePairs(inputHashesAndPaths[0].second.GetHex()) + "\", \"keypath\" : \"" + vMultisigWallets[0].baseKeyPath + "/45'/" + inputHashesAndPaths[0].first + "\" }}";
-                //printf("Command: %s\n", command.c_str());
-
-                command = "{\"sign\": { \"type\": \"meta\", \"meta\" : \"somedata\", \"data\" : [ { \"hash\" : \"" + BitPayWalletClient::ReversePairs(inputHashesAndPaths[0].second.GetHex()) + "\", \"keypath\" : \"" + vMultisigWallets[0].baseKeyPath + "/45'/" + inputHashesAndPaths[0].first + "\" } ] } }";
-                printf("Command: %s\n", command.c_str());
-
-                QTexecuteCommandWrapper(command, DBB_PROCESS_INFOLAYER_STYLE_NO_INFO, [&ret, values, inputHashesAndPaths, this](const std::string& cmdOut, dbb_cmd_execution_status_t status) {
-                        //send a signal to the main thread
-                    printf("cmd back: %s\n", cmdOut.c_str());
-                    UniValue jsonOut(UniValue::VOBJ);
-                    jsonOut.read(cmdOut);
-                    
-                    UniValue echoStr = find_value(jsonOut, "echo");
-                    if (!echoStr.isNull() && echoStr.isStr())
-                    {
-
-                        emit shouldVerifySigning(QString::fromStdString(echoStr.get_str()));
-                    }
-                    else
-                    {                    
-                        UniValue signObject = find_value(jsonOut, "sign");
-                        if (signObject.isArray()) {
-                            std::vector<UniValue> vSignatureObjects;
-                            vSignatureObjects = signObject.getValues();
-                            if (vSignatureObjects.size() > 0) {
-                                UniValue sigObject = find_value(vSignatureObjects[0], "sig");
-                                UniValue pubKey = find_value(vSignatureObjects[0], "pubkey");
-                                if (!sigObject.isNull() && sigObject.isStr())
-                                {                    
-                                    //TODO: verify signature
-                            
-                                    std::vector<std::string> sigs;
-                                    sigs.push_back(sigObject.get_str());
-                                    emit signedProposalAvailable(values[0], sigs);
-                                    ret = true;
-                                    //client.BroadcastProposal(values[0]);
-                                }
+                    emit shouldVerifySigning(QString::fromStdString(echoStr.get_str()));
+                }
+                else
+                {                    
+                    const UniValue& signObject = find_value(jsonOut, "sign");
+                    if (!signObject.isNull()) {
+                        //one signature with its pubkey is expected for every input
+                        bool malformed = !signObject.isArray() || signObject.size() != inputHashesAndPaths.size();
+                        std::vector<std::string> sigs;
+                        std::vector<std::string> pubKeys;
+                        for (size_t i = 0; !malformed && i < signObject.size(); i++) {
+                            const UniValue& sigObject = find_value(signObject[i], "sig");
+                            const UniValue& pubKey = find_value(signObject[i], "pubkey");
+                            if (!sigObject.isStr() || !pubKey.isStr()) {
+                                malformed = true;
+                                break;
                             }
+                            sigs.push_back(sigObject.get_str());
+                            pubKeys.push_back(pubKey.get_str());
+                        }
+
+                        //catch bad signatures before they reach the wallet server
+                        std::vector<bool> validSigs;
+                        if (malformed)
+                            emit signedProposalMalformed();
+                        else if (BitPayWalletClient::VerifyInputSignatures(inputHashesAndPaths, sigs, pubKeys, validSigs)) {
+                            emit signedProposalAvailable(proposal, sigs);
+                            ret = true;
+                            //client.BroadcastProposal(proposal);
                         }
-                        
+                        else
+                            emit signedProposalInvalid();
                     }
-                });
-            }
+                    
+                }
+            });
         }
     }
     return ret;
 }
 
+void DBBDaemonGui::showInvalidSignatures()
+{
+    QMessageBox::warning(this, tr("Invalid Signature"),
+                         tr("The device returned an invalid signature, the payment proposal was not signed"),
+                         QMessageBox::Ok);
+}
+
+void DBBDaemonGui::showMalformedSignResponse()
+{
+    QMessageBox::warning(this, tr("Signing Error"),
+                         tr("The device returned an incomplete signing response, the payment proposal was not signed"),
+                         QMessageBox::Ok);
+}
+
 void DBBDaemonGui::postSignedPaymentProposal(const UniValue& proposal, const std::vector<std::string> &vSigs)
 {
     vMultisigWallets[0].client.PostSignaturesForTxProposal(proposal, vSigs);
 }
 
-bool DBBDaemonGui::sendCommand(const std::string& cmd, const std::string& password, dbb_response_type_t tag)
+bool DBBDaemonGui::sendCommand(const std::string& cmd, const DBB::SessionKeyRef& key, dbb_response_type_t tag)
 {
     //ensure we don't fill the queue
     //at the moment the UI should only post one command into the queue
@@ -307,10 +325,8 @@ bool DBBDaemonGui::sendCommand(const std::string& cmd, const std::string& passwo
     }
     this->ui->textEdit->setText("processing...");
     processComnand = true;
-    QTexecuteCommandWrapper(cmd, DBB_PROCESS_INFOLAYER_STYLE_NO_INFO, [this, tag](const std::string& cmdOut, dbb_cmd_execution_status_t status) {
+    QTexecuteCommandWrapper(DBB::SecureString(cmd.begin(), cmd.end()), DBB_PROCESS_INFOLAYER_STYLE_NO_INFO, [this, tag](const UniValue& jsonOut, dbb_cmd_execution_status_t status) {
             //send a signal to the main thread
-        UniValue jsonOut;
-        jsonOut.read(cmdOut);
         emit gotResponse(jsonOut, status, tag);
     });
     return true;
@@ -337,6 +353,10 @@ void DBBDaemonGui::changeConnectedState(bool state)
             deviceConnected = false;
             this->statusBarLabelLeft->setText("No Device Found");
             this->statusBarButton->setVisible(false);
+
+            //don't wait for a response of a detached device
+            if (currentCommandToken)
+                currentCommandToken->cancel();
         }
 
         checkDevice();
@@ -345,24 +365,19 @@ void DBBDaemonGui::changeConnectedState(bool state)
 
 void DBBDaemonGui::eraseClicked()
 {
-    if (QTexecuteCommandWrapper("{\"reset\":\"__ERASE__\"}", DBB_PROCESS_INFOLAYER_STYLE_TOUCHBUTTON, [this](const std::string& cmdOut, dbb_cmd_execution_status_t status) {
-            UniValue jsonOut;
-            jsonOut.read(cmdOut);
+    if (QTexecuteCommandWrapper("{\"reset\":\"__ERASE__\"}", DBB_PROCESS_INFOLAYER_STYLE_TOUCHBUTTON, [this](const UniValue& jsonOut, dbb_cmd_execution_status_t status) {
             emit gotResponse(jsonOut, status, DBB_RESPONSE_TYPE_ERASE);
         }))
     {
         vMultisigWallets[0].client.RemoveLocalData();
-        sessionPasswordDuringChangeProcess = sessionPassword;
-        sessionPassword.clear();
+        sessionKeyDuringChangeProcess = sessionKey;
+        sessionKey.reset();
     }
 }
 
 void DBBDaemonGui::ledClicked()
 {
-    QTexecuteCommandWrapper("{\"led\" : \"toggle\"}", DBB_PROCESS_INFOLAYER_STYLE_NO_INFO, [this](const std::string& cmdOut, dbb_cmd_execution_status_t status) {
-        UniValue jsonOut;
-        jsonOut.read(cmdOut);
-
+    QTexecuteCommandWrapper("{\"led\" : \"toggle\"}", DBB_PROCESS_INFOLAYER_STYLE_NO_INFO, [this](const UniValue& jsonOut, dbb_cmd_execution_status_t status) {
         emit gotResponse(jsonOut, status, DBB_RESPONSE_TYPE_LED_BLINK);
     });
 }
@@ -373,6 +388,23 @@ void DBBDaemonGui::parseResponse(const UniValue &response, dbb_cmd_execution_sta
 {
     processComnand = false;
     setLoading(false);
+    currentCommandToken.reset();
+
+    if (status == DBB_CMD_EXECUTION_STATUS_TIMEOUT || status == DBB_CMD_EXECUTION_STATUS_CANCELED || status == DBB_CMD_EXECUTION_STATUS_DEVICE_ERROR)
+    {
+        //a pending password change or erase did not complete
+        if (sessionKeyDuringChangeProcess)
+        {
+            sessionKey = sessionKeyDuringChangeProcess;
+            sessionKeyDuringChangeProcess.reset();
+        }
+
+        if (status == DBB_CMD_EXECUTION_STATUS_TIMEOUT)
+            QMessageBox::warning(this, tr("Timeout"), tr("The device did not respond in time"), QMessageBox::Ok);
+        else if (status == DBB_CMD_EXECUTION_STATUS_DEVICE_ERROR)
+            QMessageBox::warning(this, tr("Device Error"), tr("The command could not be sent to the device"), QMessageBox::Ok);
+        return;
+    }
 
     if (response.isObject())
     {
@@ -410,7 +442,7 @@ void DBBDaemonGui::parseResponse(const UniValue &response, dbb_cmd_execution_sta
                 //password wrong
                 QMessageBox::warning(this, tr("Password Error"), QString::fromStdString(errorMessageObj.get_str()), QMessageBox::Ok);
 
-                sessionPassword.clear();
+                sessionKey.reset();
                 setPasswordClicked();
             }
             else
@@ -474,7 +506,7 @@ void DBBDaemonGui::parseResponse(const UniValue &response, dbb_cmd_execution_sta
             UniValue passwordObj = find_value(response, "password");
             if (status != DBB_CMD_EXECUTION_STATUS_OK || (passwordObj.isStr() && passwordObj.get_str() == "success"))
             {
-                sessionPasswordDuringChangeProcess.clear();
+                sessionKeyDuringChangeProcess.reset();
 
                 //could not decrypt, password was changed successfully
                 QMessageBox::information(this, tr("Password Set"), tr("Password has been set successfully!"), QMessageBox::Ok);
@@ -491,8 +523,8 @@ void DBBDaemonGui::parseResponse(const UniValue &response, dbb_cmd_execution_sta
                 }
 
                 //reset password in case of an error
-                sessionPassword = sessionPasswordDuringChangeProcess;
-                sessionPasswordDuringChangeProcess.clear();
+                sessionKey = sessionKeyDuringChangeProcess;
+                sessionKeyDuringChangeProcess.reset();
 
                 QMessageBox::warning(this, tr("Password Error"), tr("Could not set password (error: %1)!").arg(errorString), QMessageBox::Ok);
             }
@@ -566,13 +598,13 @@ void DBBDaemonGui::parseResponse(const UniValue &response, dbb_cmd_execution_sta
             if (resetObj.isStr() && resetObj.get_str() == "success")
             {
                 QMessageBox::information(this, tr("Erase"), tr("Device was erased successfully"), QMessageBox::Ok);
-                sessionPasswordDuringChangeProcess.clear();
+                sessionKeyDuringChangeProcess.reset();
             }
             else
             {
                 //reset password in case of an error
-                sessionPassword = sessionPasswordDuringChangeProcess;
-                sessionPasswordDuringChangeProcess.clear();
+                sessionKey = sessionKeyDuringChangeProcess;
+                sessionKeyDuringChangeProcess.reset();
 
                 if (!touchErrorShowed)
                     QMessageBox::warning(this, tr("Erase error"), tr("Could not reset device"), QMessageBox::Ok);
@@ -593,7 +625,7 @@ void DBBDaemonGui::checkDevice()
     if (!deviceConnected)
     {
         resetInfos();
-        sessionPassword.clear();
+        sessionKey.reset();
     }
     else
     {
@@ -641,9 +673,7 @@ void DBBDaemonGui::updateOverviewFlags(bool walletAvailable, bool lockAvailable,
 
 void DBBDaemonGui::getInfo()
 {
-    QTexecuteCommandWrapper("{\"device\":\"info\"}", DBB_PROCESS_INFOLAYER_STYLE_NO_INFO, [this](const std::string& cmdOut, dbb_cmd_execution_status_t status) {
-        UniValue jsonOut;
-        jsonOut.read(cmdOut);
+    QTexecuteCommandWrapper("{\"device\":\"info\"}", DBB_PROCESS_INFOLAYER_STYLE_NO_INFO, [this](const UniValue& jsonOut, dbb_cmd_execution_status_t status) {
         emit gotResponse(jsonOut, status, DBB_RESPONSE_TYPE_INFO);
     });
 }
@@ -653,16 +683,18 @@ void DBBDaemonGui::setPasswordClicked()
     bool ok;
     QString text = QInputDialog::getText(this, tr("Set New Password"), tr("Password"), QLineEdit::Normal, "0000", &ok);
     if (ok && !text.isEmpty()) {
-        std::string command = "{\"password\" : \"" + text.toStdString() + "\"}";
+        //keep the password out of the regular heap (as far as Qt allows)
+        QByteArray utf8 = text.toUtf8();
+        DBB::SecureString password(utf8.constData(), utf8.size());
+        utf8.fill(0);
+        DBB::SecureString command = "{\"password\" : \"" + password + "\"}";
 
-        if (QTexecuteCommandWrapper(command, DBB_PROCESS_INFOLAYER_STYLE_TOUCHBUTTON, [this](const std::string& cmdOut, dbb_cmd_execution_status_t status) {
-                UniValue jsonOut;
-                jsonOut.read(cmdOut);
+        if (QTexecuteCommandWrapper(command, DBB_PROCESS_INFOLAYER_STYLE_TOUCHBUTTON, [this](const UniValue& jsonOut, dbb_cmd_execution_status_t status) {
                 emit gotResponse(jsonOut, status, DBB_RESPONSE_TYPE_PASSWORD);
             }))
         {
-            sessionPasswordDuringChangeProcess = sessionPassword;
-            sessionPassword = text.toStdString();
+            sessionKeyDuringChangeProcess = sessionKey;
+            sessionKey.reset(new DBB::SessionKey(password));
         }
     }
 
@@ -670,13 +702,11 @@ void DBBDaemonGui::setPasswordClicked()
 
 void DBBDaemonGui::seed()
 {
-    std::string command = "{\"seed\" : {\"source\" :\"create\","
+    DBB::SecureString command = "{\"seed\" : {\"source\" :\"create\","
                         "\"decrypt\": \"no\","
                         "\"salt\" : \"\"} }";
 
-    QTexecuteCommandWrapper(command, DBB_PROCESS_INFOLAYER_STYLE_TOUCHBUTTON, [this](const std::string& cmdOut, dbb_cmd_execution_status_t status) {
-        UniValue jsonOut;
-        jsonOut.read(cmdOut);
+    QTexecuteCommandWrapper(command, DBB_PROCESS_INFOLAYER_STYLE_TOUCHBUTTON, [this](const UniValue& jsonOut, dbb_cmd_execution_status_t status) {
         emit gotResponse(jsonOut, status, DBB_RESPONSE_TYPE_CREATE_WALLET);
     });
 }
@@ -724,14 +754,14 @@ void DBBDaemonGui::_JoinCopayWallet()
 
 void DBBDaemonGui::GetXPubKey()
 {
-    sendCommand("{\"xpub\":\"" + vMultisigWallets[0].baseKeyPath + "/45'\"}", sessionPassword, DBB_RESPONSE_TYPE_XPUB_MS_MASTER);
+    sendCommand("{\"xpub\":\"" + vMultisigWallets[0].baseKeyPath + "/45'\"}", sessionKey, DBB_RESPONSE_TYPE_XPUB_MS_MASTER);
 }
 
 void DBBDaemonGui::GetRequestXPubKey()
 {
     //try to get the xpub for seeding the request private key (ugly workaround)
     //we cannot export private keys from a hardware wallet
-    sendCommand("{\"xpub\":\"" + vMultisigWallets[0].baseKeyPath + "/1'/0\"}", sessionPassword, DBB_RESPONSE_TYPE_XPUB_MS_REQUEST);
+    sendCommand("{\"xpub\":\"" + vMultisigWallets[0].baseKeyPath + "/1'/0\"}", sessionKey, DBB_RESPONSE_TYPE_XPUB_MS_REQUEST);
 }
 
 
@@ -39,6 +39,7 @@ typedef enum DBB_RESPONSE_TYPE
     DBB_RESPONSE_TYPE_INFO,
     DBB_RESPONSE_TYPE_ERASE,
     DBB_RESPONSE_TYPE_LED_BLINK,
+    DBB_RESPONSE_TYPE_SIGN,
 } dbb_response_type_t;
 
 typedef enum DBB_PROCESS_INFOLAYER_STYLE
@@ -64,15 +65,16 @@ private:
     QPushButton* statusBarButton;
     bool processComnand;
     bool deviceConnected;
-    std::string sessionPassword; //TODO: needs secure space / mem locking
-    std::string sessionPasswordDuringChangeProcess; //TODO: needs secure space / mem locking
+    DBB::SessionKeyRef sessionKey; //!< key derived from the session password (locked memory)
+    DBB::SessionKeyRef sessionKeyDuringChangeProcess;
     QString versionString;
     bool versionStringLoaded;
     std::vector<DBBMultisigWallet> vMultisigWallets;
+    DBB::CancellationTokenRef currentCommandToken; //!< token of the command in process
 
-    bool sendCommand(const std::string& cmd, const std::string& password, dbb_response_type_t tag = DBB_RESPONSE_TYPE_UNKNOWN);
+    bool sendCommand(const std::string& cmd, const DBB::SessionKeyRef& key, dbb_response_type_t tag = DBB_RESPONSE_TYPE_UNKNOWN);
     void _JoinCopayWallet();
-    bool QTexecuteCommandWrapper(const std::string& cmd, const dbb_process_infolayer_style_t layerstyle, std::function<void(const std::string&, dbb_cmd_execution_status_t status)> cmdFinished);
+    bool QTexecuteCommandWrapper(const DBB::SecureString& cmd, const dbb_process_infolayer_style_t layerstyle, std::function<void(const UniValue&, dbb_cmd_execution_status_t status)> cmdFinished);
 
 public slots:
     void askForSessionPassword();
@@ -103,6 +105,8 @@ public slots:
 
     void parseResponse(const UniValue& response, dbb_cmd_execution_status_t status, dbb_response_type_t tag);
     void showEchoVerification(QString echoStr);
+    void showInvalidSignatures();
+    void showMalformedSignResponse();
     void postSignedPaymentProposal(const UniValue& proposal, const std::vector<std::string> &vSigs);
 
 signals:
@@ -114,6 +118,8 @@ signals:
 
     void shouldVerifySigning(const QString& signature);
     void signedProposalAvailable(const UniValue& proposal, const std::vector<std::string> &vSigs);
+    void signedProposalInvalid();
+    void signedProposalMalformed();
 };
 
 #endif
@@ -0,0 +1,205 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test_dbb.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "libdbb/crypto.h"
+
+//the former char by char implementation, the reference for the block functions
+static const std::string ref_base64_chars =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "abcdefghijklmnopqrstuvwxyz"
+    "0123456789+/";
+
+static inline bool ref_is_base64(unsigned char c)
+{
+    return (isalnum(c) || (c == '+') || (c == '/'));
+}
+
+static std::string ref_base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len)
+{
+    std::string ret;
+    int i = 0;
+    int j = 0;
+    unsigned char char_array_3[3];
+    unsigned char char_array_4[4];
+
+    while (in_len--) {
+        char_array_3[i++] = *(bytes_to_encode++);
+        if (i == 3) {
+            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
+            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
+            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
+            char_array_4[3] = char_array_3[2] & 0x3f;
+
+            for (i = 0; (i < 4); i++)
+                ret += ref_base64_chars[char_array_4[i]];
+            i = 0;
+        }
+    }
+
+    if (i) {
+        for (j = i; j < 3; j++)
+            char_array_3[j] = '\0';
+
+        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
+        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
+        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
+        char_array_4[3] = char_array_3[2] & 0x3f;
+
+        for (j = 0; (j < i + 1); j++)
+            ret += ref_base64_chars[char_array_4[j]];
+
+        while ((i++ < 3))
+            ret += '=';
+    }
+
+    return ret;
+}
+
+static std::string ref_base64_decode(std::string const& encoded_string)
+{
+    int in_len = encoded_string.size();
+    int i = 0;
+    int j = 0;
+    int in_ = 0;
+    unsigned char char_array_4[4], char_array_3[3];
+    std::string ret;
+
+    while (in_len-- && (encoded_string[in_] != '=') && ref_is_base64(encoded_string[in_])) {
+        char_array_4[i++] = encoded_string[in_];
+        in_++;
+        if (i == 4) {
+            for (i = 0; i < 4; i++)
+                char_array_4[i] = ref_base64_chars.find(char_array_4[i]);
+
+            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
+            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
+            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+
+            for (i = 0; (i < 3); i++)
+                ret += char_array_3[i];
+            i = 0;
+        }
+    }
+
+    if (i) {
+        for (j = i; j < 4; j++)
+            char_array_4[j] = 0;
+
+        for (j = 0; j < 4; j++)
+            char_array_4[j] = ref_base64_chars.find(char_array_4[j]);
+
+        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
+        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
+        char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+
+        for (j = 0; (j < i - 1); j++)
+            ret += char_array_3[j];
+    }
+
+    return ret;
+}
+
+//every byte value, in an order that differs from block to block
+static std::string TestBytes(size_t len)
+{
+    std::string bytes(len, '\0');
+    for (size_t i = 0; i < len; i++)
+        bytes[i] = (char)(i * 167 + (i >> 8) * 13 + 5);
+    return bytes;
+}
+
+//base64_decode() through the buffer interface
+static std::string Decode(const std::string& encoded)
+{
+    std::string out(base64_decoded_size_max(encoded.size()), '\0');
+    out.resize(base64_decode(encoded.data(), encoded.size(), (unsigned char*)(out.empty() ? NULL : &out[0])));
+    return out;
+}
+
+//run check on the scalar code and every block implementation the CPU has
+static void ForEachBase64Implementation(const std::function<void()>& check)
+{
+    const std::string selected = base64_implementation();
+    const char* implementations[] = {"generic", "ssse3", "avx2"};
+    for (const char* name : implementations) {
+        if (!base64_select_implementation(name)) {
+            printf("  base64 %s not supported, skipped\n", name);
+            continue;
+        }
+        check();
+    }
+    base64_select_implementation(selected.c_str());
+}
+
+TEST_CASE(Base64EncodeMatchesReference)
+{
+    ForEachBase64Implementation([]() {
+        for (size_t len = 0; len <= 300; len++) {
+            std::string bytes = TestBytes(len);
+            std::string expected = ref_base64_encode((const unsigned char*)bytes.data(), len);
+
+            CHECK(base64_encode((const unsigned char*)bytes.data(), len) == expected);
+
+            std::string out(base64_encoded_size(len), '\0');
+            CHECK(base64_encode((const unsigned char*)bytes.data(), len, out.empty() ? NULL : &out[0]) == expected.size());
+            CHECK(out == expected);
+        }
+    });
+}
+
+TEST_CASE(Base64DecodeMatchesReference)
+{
+    ForEachBase64Implementation([]() {
+        for (size_t len = 0; len <= 300; len++) {
+            std::string bytes = TestBytes(len);
+            std::string encoded = ref_base64_encode((const unsigned char*)bytes.data(), len);
+
+            CHECK(base64_decode(encoded) == bytes);
+            CHECK(Decode(encoded) == bytes);
+
+            //without the padding
+            std::string unpadded = encoded.substr(0, encoded.find('='));
+            CHECK(base64_decode(unpadded) == ref_base64_decode(unpadded));
+        }
+    });
+}
+
+//decoding stops at the first padding or non base64 char, wherever it is
+TEST_CASE(Base64DecodeInvalidInput)
+{
+    const char stops[] = {'=', '!', '-', '_', ' ', '\n', '\0', '\x80', '\xff'};
+    ForEachBase64Implementation([&stops]() {
+        for (size_t len = 0; len <= 300; len += 7) {
+            std::string bytes = TestBytes(len);
+            std::string encoded = ref_base64_encode((const unsigned char*)bytes.data(), len);
+
+            for (size_t pos = 0; pos <= encoded.size(); pos++) {
+                for (char stop : stops) {
+                    std::string invalid = encoded;
+                    invalid.insert(pos, 1, stop);
+                    std::string expected = ref_base64_decode(invalid);
+                    CHECK(base64_decode(invalid) == expected);
+                    CHECK(Decode(invalid) == expected);
+
+                    //the char replacing a valid one
+                    if (pos < encoded.size()) {
+                        invalid = encoded;
+                        invalid[pos] = stop;
+                        expected = ref_base64_decode(invalid);
+                        CHECK(base64_decode(invalid) == expected);
+                        CHECK(Decode(invalid) == expected);
+                    }
+                }
+            }
+        }
+    });
+}
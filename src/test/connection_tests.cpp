@@ -0,0 +1,134 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test_dbb.h"
+
+#include "libdbb/connection.h"
+#include "libdbb/transport.h"
+
+//open a connection over a loopback transport, the transport stays owned by the connection
+static DBB::LoopbackTransport* OpenLoopback(DBB::Connection& connection)
+{
+    DBB::LoopbackTransport* loopback = new DBB::LoopbackTransport();
+    connection.setTransport(std::unique_ptr<DBB::Transport>(loopback));
+    connection.open();
+    return loopback;
+}
+
+TEST_CASE(ConnectionRoundTrip)
+{
+    DBB::Connection connection;
+    OpenLoopback(connection);
+
+    std::string result;
+    CHECK(connection.sendCommand("{\"ping\":1}", result, 1000, NULL) == DBB::DBB_COMMAND_STATUS_OK);
+    CHECK(result == "{\"ping\":1}");
+}
+
+//the response of a timed out command arrives while the next command drains
+TEST_CASE(ConnectionLateResponseIsDrained)
+{
+    DBB::Connection connection;
+    DBB::LoopbackTransport* loopback = OpenLoopback(connection);
+
+    std::string result;
+    loopback->setResponseDelay(200);
+    CHECK(connection.sendCommand("{\"first\":1}", result, 50, NULL) == DBB::DBB_COMMAND_STATUS_TIMEOUT);
+
+    loopback->setResponseDelay(0);
+    CHECK(connection.sendCommand("{\"second\":2}", result, 1000, NULL) == DBB::DBB_COMMAND_STATUS_OK);
+    CHECK(result == "{\"second\":2}");
+
+    CHECK(connection.sendCommand("{\"third\":3}", result, 1000, NULL) == DBB::DBB_COMMAND_STATUS_OK);
+    CHECK(result == "{\"third\":3}");
+    CHECK(connection.isOpen());
+}
+
+//a slow response is dropped when it arrives, however late that is
+TEST_CASE(ConnectionSlowLateResponse)
+{
+    DBB::Connection connection;
+    DBB::LoopbackTransport* loopback = OpenLoopback(connection);
+
+    std::string result;
+    loopback->setResponseDelay(1000);
+    CHECK(connection.sendCommand("{\"first\":1}", result, 50, NULL) == DBB::DBB_COMMAND_STATUS_TIMEOUT);
+
+    loopback->setResponseDelay(0);
+    CHECK(connection.sendCommand("{\"second\":2}", result, 3000, NULL) == DBB::DBB_COMMAND_STATUS_OK);
+    CHECK(result == "{\"second\":2}");
+    CHECK(connection.isOpen());
+}
+
+//the device still owes the response after the connection got reopened
+TEST_CASE(ConnectionLateResponseSurvivesReopen)
+{
+    DBB::Connection connection;
+    DBB::LoopbackTransport* loopback = OpenLoopback(connection);
+
+    std::string result;
+    loopback->setResponseDelay(700);
+    CHECK(connection.sendCommand("{\"first\":1}", result, 50, NULL) == DBB::DBB_COMMAND_STATUS_TIMEOUT);
+    connection.close();
+    CHECK(connection.open());
+
+    loopback->setResponseDelay(0);
+    CHECK(connection.sendCommand("{\"second\":2}", result, 3000, NULL) == DBB::DBB_COMMAND_STATUS_OK);
+    CHECK(result == "{\"second\":2}");
+}
+
+//the responses of several aborted commands are dropped in order
+TEST_CASE(ConnectionLateResponsesInOrder)
+{
+    DBB::Connection connection;
+    DBB::LoopbackTransport* loopback = OpenLoopback(connection);
+
+    std::string result;
+    loopback->setResponseDelay(300);
+    CHECK(connection.sendCommand("{\"first\":1}", result, 50, NULL) == DBB::DBB_COMMAND_STATUS_TIMEOUT);
+    CHECK(connection.sendCommand("{\"second\":2}", result, 50, NULL) == DBB::DBB_COMMAND_STATUS_TIMEOUT);
+
+    loopback->setResponseDelay(0);
+    CHECK(connection.sendCommand("{\"third\":3}", result, 3000, NULL) == DBB::DBB_COMMAND_STATUS_OK);
+    CHECK(result == "{\"third\":3}");
+    CHECK(connection.sendCommand("{\"fourth\":4}", result, 1000, NULL) == DBB::DBB_COMMAND_STATUS_OK);
+    CHECK(result == "{\"fourth\":4}");
+}
+
+//a command canceled before it was sent leaves no response behind
+TEST_CASE(ConnectionCanceledBeforeWrite)
+{
+    DBB::Connection connection;
+    OpenLoopback(connection);
+
+    DBB::CancellationToken token;
+    token.cancel();
+    std::string result;
+    CHECK(connection.sendCommand("{\"first\":1}", result, 1000, &token) == DBB::DBB_COMMAND_STATUS_CANCELED);
+
+    CHECK(connection.sendCommand("{\"second\":2}", result, 1000, NULL) == DBB::DBB_COMMAND_STATUS_OK);
+    CHECK(result == "{\"second\":2}");
+}
+
+//a command canceled while waiting leaves its response behind as well
+TEST_CASE(ConnectionCanceledResponseIsDrained)
+{
+    DBB::CancellationToken token;
+    DBB::LoopbackTransport* loopback = new DBB::LoopbackTransport([&token](const std::string& request) {
+        //the user cancels as soon as the device got the command
+        token.cancel();
+        return request;
+    });
+    DBB::Connection connection;
+    connection.setTransport(std::unique_ptr<DBB::Transport>(loopback));
+    connection.open();
+
+    std::string result;
+    loopback->setResponseDelay(300);
+    CHECK(connection.sendCommand("{\"first\":1}", result, 1000, &token) == DBB::DBB_COMMAND_STATUS_CANCELED);
+
+    loopback->setResponseDelay(0);
+    CHECK(connection.sendCommand("{\"second\":2}", result, 1000, NULL) == DBB::DBB_COMMAND_STATUS_OK);
+    CHECK(result == "{\"second\":2}");
+}
@@ -0,0 +1,141 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test_dbb.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "libdbb/crypto.h"
+
+static std::string DigestHex(const unsigned char* digest)
+{
+    static const char hexChars[] = "0123456789abcdef";
+    std::string hex;
+    for (int i = 0; i < DBB_SHA256_DIGEST_LENGTH; i++) {
+        hex += hexChars[digest[i] >> 4];
+        hex += hexChars[digest[i] & 0x0f];
+    }
+    return hex;
+}
+
+static std::string Sha256Hex(const std::string& msg)
+{
+    unsigned char digest[DBB_SHA256_DIGEST_LENGTH];
+    sha256((const unsigned char*)msg.data(), msg.size(), digest);
+    return DigestHex(digest);
+}
+
+//known answers, the lengths around 55/56 and 119/120 bytes move the padding into an extra block
+class SHA256Vector
+{
+public:
+    std::string msg;
+    const char* digest;
+};
+
+static std::vector<SHA256Vector> SHA256Vectors()
+{
+    std::vector<SHA256Vector> vectors = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+        {std::string(1, 'a'), "ca978112ca1bbdcafac231b39a23dc4da786eff8147c4e72b9807785afee48bb"},
+        {std::string(55, 'a'), "9f4390f8d30c2dd92ec9f095b65e2b9ae9b0a925a5258e241c9f1e910f734318"},
+        {std::string(56, 'a'), "b35439a4ac6f0948b6d6f9e3c6af0f5f590ce20f1bde7090ef7970686ec6738a"},
+        {std::string(63, 'a'), "7d3e74a05d7db15bce4ad9ec0658ea98e3f06eeecf16b4c6fff2da457ddc2f34"},
+        {std::string(64, 'a'), "ffe054fe7ae0cb6dc65c3af9b61d5209f439851db43d0ba5997337df154668eb"},
+        {std::string(65, 'a'), "635361c48bb9eab14198e76ea8ab7f1a41685d6ad62aa9146d301d4f17eb0ae0"},
+        {std::string(119, 'a'), "31eba51c313a5c08226adf18d4a359cfdfd8d2e816b13f4af952f7ea6584dcfb"},
+        {std::string(120, 'a'), "2f3d335432c70b580af0e8e1b3674a7c020d683aa5f73aaaedfdc55af904c21c"},
+        {std::string(1000, 'a'), "41edece42d63e8d9bf515a9ba6932e1c20cbc9f5a5d134645adb5db1b9737ea3"},
+        {std::string(1000000, 'a'), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+    };
+    return vectors;
+}
+
+//run check on every implementation the CPU has
+static void ForEachSHA256Implementation(const std::function<void()>& check)
+{
+    const std::string selected = sha256_implementation();
+    const char* implementations[] = {"generic", "shani", "avx2"};
+    for (const char* name : implementations) {
+        if (!sha256_select_implementation(name)) {
+            printf("  sha256 %s not supported, skipped\n", name);
+            continue;
+        }
+        check();
+    }
+    sha256_select_implementation(selected.c_str());
+}
+
+TEST_CASE(SHA256KnownAnswers)
+{
+    ForEachSHA256Implementation([]() {
+        for (const SHA256Vector& kat : SHA256Vectors())
+            CHECK(Sha256Hex(kat.msg) == kat.digest);
+    });
+}
+
+//the message written in pieces of every size gives the same digest
+TEST_CASE(SHA256IncrementalWrites)
+{
+    ForEachSHA256Implementation([]() {
+        for (const SHA256Vector& kat : SHA256Vectors()) {
+            if (kat.msg.size() > 1000)
+                continue;
+            const unsigned char* msg = (const unsigned char*)kat.msg.data();
+            for (size_t piece = 1; piece <= 130; piece++) {
+                SHA256Hasher hasher;
+                for (size_t pos = 0; pos < kat.msg.size(); pos += piece)
+                    hasher.write(msg + pos, std::min(piece, kat.msg.size() - pos));
+                unsigned char digest[DBB_SHA256_DIGEST_LENGTH];
+                hasher.finalize(digest);
+                CHECK(DigestHex(digest) == kat.digest);
+
+                //finalize() resets the hasher
+                hasher.write(msg, kat.msg.size());
+                hasher.finalize(digest);
+                CHECK(DigestHex(digest) == kat.digest);
+            }
+        }
+    });
+}
+
+//batches of mixed lengths, smaller and larger than the multi-buffer minimum
+TEST_CASE(SHA256ManyMixedLengths)
+{
+    std::vector<std::string> messages;
+    for (size_t i = 0; i < 37; i++)
+        messages.push_back(std::string((i * 53) % 300, (char)('a' + i % 26)));
+    for (const SHA256Vector& kat : SHA256Vectors())
+        messages.push_back(kat.msg);
+
+    //the digests one by one over the portable code
+    std::vector<std::string> expected;
+    const std::string selected = sha256_implementation();
+    sha256_select_implementation("generic");
+    for (const std::string& msg : messages)
+        expected.push_back(Sha256Hex(msg));
+    sha256_select_implementation(selected.c_str());
+
+    ForEachSHA256Implementation([&messages, &expected]() {
+        for (size_t count = 0; count <= messages.size(); count++) {
+            std::vector<const unsigned char*> data;
+            std::vector<size_t> lens;
+            for (size_t i = 0; i < count; i++) {
+                data.push_back((const unsigned char*)messages[i].data());
+                lens.push_back(messages[i].size());
+            }
+            std::vector<unsigned char> hashes(count * DBB_SHA256_DIGEST_LENGTH + 1, 0);
+            sha256_many(data.data(), lens.data(), count, hashes.data());
+            for (size_t i = 0; i < count; i++)
+                CHECK(DigestHex(&hashes[i * DBB_SHA256_DIGEST_LENGTH]) == expected[i]);
+            CHECK(hashes[count * DBB_SHA256_DIGEST_LENGTH] == 0);
+        }
+    });
+}
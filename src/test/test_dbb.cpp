@@ -0,0 +1,70 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test_dbb.h"
+
+#include <stdio.h>
+
+#include <exception>
+
+namespace test
+{
+static int checkFailures = 0;
+
+bool Check(bool cond, const char* expr, const char* file, int line)
+{
+    if (!cond) {
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+        checkFailures++;
+    }
+    return cond;
+}
+
+std::map<std::string, TestFunction>& TestRunner::tests()
+{
+    static std::map<std::string, TestFunction> tests_map;
+    return tests_map;
+}
+
+TestRunner::TestRunner(const std::string& name, TestFunction func)
+{
+    tests().insert(std::make_pair(name, func));
+}
+
+int TestRunner::RunAll(const std::string& filter)
+{
+    int failed = 0;
+    for (const auto& it : tests()) {
+        if (it.first.find(filter) == std::string::npos)
+            continue;
+
+        int failuresBefore = checkFailures;
+        bool ok = true;
+        try {
+            it.second();
+        } catch (const std::exception& e) {
+            fprintf(stderr, "%s: unexpected exception: %s\n", it.first.c_str(), e.what());
+            ok = false;
+        }
+        if (checkFailures != failuresBefore)
+            ok = false;
+
+        printf("%-40s %s\n", it.first.c_str(), ok ? "ok" : "FAILED");
+        if (!ok)
+            failed++;
+    }
+    return failed;
+}
+}
+
+int main(int argc, char** argv)
+{
+    //an optional argument only runs the tests containing it
+    int failed = test::TestRunner::RunAll(argc > 1 ? argv[1] : "");
+    if (failed) {
+        fprintf(stderr, "%d test(s) failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
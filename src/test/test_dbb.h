@@ -0,0 +1,48 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef DBB_TEST_TEST_DBB_H
+#define DBB_TEST_TEST_DBB_H
+
+#include <functional>
+#include <map>
+#include <string>
+
+//unit tests for libdbb, univalue and the wallet client, run over "make check"
+//
+//a test is a function registered with TEST_CASE, failed checks are reported
+//and the test continues:
+//
+//  TEST_CASE(Base64RoundTrip)
+//  {
+//      CHECK(base64_decode(base64_encode(...)) == ...);
+//  }
+namespace test
+{
+//report a failed check (returns cond)
+bool Check(bool cond, const char* expr, const char* file, int line);
+
+typedef std::function<void()> TestFunction;
+
+class TestRunner
+{
+public:
+    TestRunner(const std::string& name, TestFunction func);
+
+    //run all tests whose name contains filter, returns the number of failed tests
+    static int RunAll(const std::string& filter);
+
+private:
+    static std::map<std::string, TestFunction>& tests();
+};
+}
+
+#define TEST_CASE(n)                                        \
+    static void n();                                        \
+    static test::TestRunner test_runner_##n(#n, n);         \
+    static void n()
+
+#define CHECK(cond) test::Check((cond), #cond, __FILE__, __LINE__)
+
+#endif // DBB_TEST_TEST_DBB_H
@@ -0,0 +1,43 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test_dbb.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libdbb/transport.h"
+
+//a response record is served over as many reads as the buffer size requires
+TEST_CASE(ReplaySmallReadBuffer)
+{
+    const std::string filename = "test_dbb_replay.cap";
+    const std::string request = "{\"ping\":1}";
+    std::string report(HID_REPORT_SIZE, 0);
+    report.replace(0, request.size(), request);
+
+    {
+        std::shared_ptr<DBB::Transport> loopback(new DBB::LoopbackTransport());
+        std::unique_ptr<DBB::CaptureTransport> capture(DBB::CaptureTransport::create(loopback, filename));
+        if (!CHECK(capture != nullptr))
+            return;
+        capture->open();
+        CHECK(capture->write((const unsigned char*)report.data(), report.size()) == HID_REPORT_SIZE);
+        CHECK(capture->read((unsigned char*)&report[0], report.size(), 0) == HID_REPORT_SIZE);
+    }
+
+    DBB::ReplayTransport replay(filename, 0);
+    CHECK(replay.open());
+    CHECK(replay.write((const unsigned char*)report.data(), report.size()) == HID_REPORT_SIZE);
+
+    std::string response;
+    unsigned char buf[100];
+    int res;
+    while ((res = replay.read(buf, sizeof(buf), 0)) > 0)
+        response.append((const char*)buf, res);
+    CHECK(response.size() == HID_REPORT_SIZE);
+    CHECK(strcmp(response.c_str(), request.c_str()) == 0);
+
+    remove(filename.c_str());
+}
@@ -0,0 +1,59 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test_dbb.h"
+
+#include <cmath>
+
+#include "univalue.h"
+
+//only whitespace (or the NUL byte ending the input) may follow the top-level value
+TEST_CASE(UniValueReadTrailingData)
+{
+    const char* invalid[] = {"{\"a\":1}}", "[1] x", "[1][2]", "{}{}", "[1],", "{} \"a\""};
+    for (const char* json : invalid) {
+        UniValue value;
+        UniValueEventHandler handler;
+        CHECK(!value.read(json));
+        CHECK(!readJsonEvents(json, handler));
+    }
+
+    const char* valid[] = {"{\"a\":1}", "[1] ", " {} \r\n\t"};
+    for (const char* json : valid) {
+        UniValue value;
+        UniValueEventHandler handler;
+        CHECK(value.read(json));
+        CHECK(readJsonEvents(json, handler));
+    }
+
+    //zero padding of a report
+    UniValue value;
+    CHECK(value.read(std::string("[1]\0\0\0garbage", 13)));
+    CHECK(value.isArray() && value.size() == 1);
+}
+
+//"-0" is an integer literal but keeps its sign as a double
+TEST_CASE(UniValueNegativeZero)
+{
+    UniValue value;
+    CHECK(value.read("[-0]"));
+    CHECK(value[0].isNum());
+    CHECK(value[0].get_real() == 0 && std::signbit(value[0].get_real()));
+    CHECK(value[0].get_int() == 0);
+    CHECK(value[0].get_int64() == 0);
+    CHECK(value.write() == "[-0]");
+}
+
+//strings are returned by reference, numbers get formatted from their binary value
+TEST_CASE(UniValueValStr)
+{
+    UniValue value;
+    CHECK(value.read("[\"abc\",true,-5,18446744073709551615,1.50]"));
+    CHECK(&value[0].getValStr() == &value[0].getValStr());
+    CHECK(value[0].getValStr() == "abc");
+    CHECK(value[1].getValStr() == "1");
+    CHECK(value[2].getNumStr() == "-5");
+    CHECK(value[3].getNumStr() == "18446744073709551615");
+    CHECK(value[4].getNumStr() == "1.50");
+}
@@ -0,0 +1,90 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test_dbb.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "libbitpay-wallet-client/bpwalletclient.h"
+
+#include "base58.h"
+#include "chainparams.h"
+#include "key.h"
+#include "primitives/transaction.h"
+#include "script/interpreter.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "utilstrencodings.h"
+#include "version.h"
+
+//every input of a multi input proposal is hashed for its own position and key path
+TEST_CASE(WalletTxProposalInputHashes)
+{
+    ECC_Start();
+    SelectParams(CBaseChainParams::TESTNET);
+
+    std::vector<CKey> keys(3);
+    std::vector<std::string> pubKeysHex;
+    for (size_t i = 0; i < keys.size(); i++) {
+        unsigned char secret[32];
+        memset(secret, (int)i + 1, sizeof(secret));
+        keys[i].Set(secret, secret + sizeof(secret), true);
+        pubKeysHex.push_back(HexStr(keys[i].GetPubKey()));
+    }
+
+    UniValue proposal(UniValue::VOBJ);
+    proposal.push_back(Pair("toAddress", CBitcoinAddress(keys[0].GetPubKey().GetID()).ToString()));
+    proposal.push_back(Pair("amount", (int64_t)100000));
+    proposal.push_back(Pair("fee", (int64_t)10000));
+    UniValue outputOrder(UniValue::VARR);
+    outputOrder.push_back(0);
+    outputOrder.push_back(1);
+    proposal.push_back(Pair("outputOrder", outputOrder));
+    proposal.push_back(Pair("requiredSignatures", 2));
+
+    UniValue inputs(UniValue::VARR);
+    for (int i = 0; i < 2; i++) {
+        UniValue input(UniValue::VOBJ);
+        input.push_back(Pair("txid", "4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b"));
+        input.push_back(Pair("vout", i));
+        input.push_back(Pair("satoshis", 500000));
+        input.push_back(Pair("path", "m/0/" + std::to_string(i)));
+        UniValue publicKeys(UniValue::VARR);
+        for (const std::string& pubKeyHex : pubKeysHex)
+            publicKeys.push_back(pubKeyHex);
+        input.push_back(Pair("publicKeys", publicKeys));
+        inputs.push_back(input);
+    }
+    proposal.push_back(Pair("inputs", inputs));
+
+    UniValue changeAddress(UniValue::VOBJ);
+    changeAddress.push_back(Pair("address", CBitcoinAddress(keys[1].GetPubKey().GetID()).ToString()));
+    proposal.push_back(Pair("changeAddress", changeAddress));
+
+    BitPayWalletClient client;
+    std::vector<std::pair<std::string, uint256> > inputHashes;
+    std::string hex = client.ParseTxProposal(proposal, inputHashes);
+
+    CTransaction tx;
+    CDataStream ssTx(ParseHex(hex), SER_NETWORK, PROTOCOL_VERSION);
+    ssTx >> tx;
+    CHECK(tx.vin.size() == 2 && inputHashes.size() == 2);
+
+    //the multisig script over the sorted keys, the same for both inputs
+    std::sort(pubKeysHex.begin(), pubKeysHex.end());
+    std::vector<CPubKey> sortedKeys;
+    for (const std::string& pubKeyHex : pubKeysHex)
+        sortedKeys.push_back(CPubKey(ParseHex(pubKeyHex)));
+    CScript script = GetScriptForMultisig(2, sortedKeys);
+
+    for (unsigned int n = 0; n < tx.vin.size() && n < inputHashes.size(); n++) {
+        CHECK(inputHashes[n].first == "0/" + std::to_string(tx.vin[n].prevout.n));
+        CHECK(inputHashes[n].second == SignatureHash(script, tx, n, SIGHASH_ALL));
+    }
+    CHECK(inputHashes.size() < 2 || inputHashes[0].second != inputHashes[1].second);
+
+    ECC_Stop();
+}
@@ -5,15 +5,17 @@
 
 #include <stdint.h>
 #include <ctype.h>
-#include <iomanip>
+#include <iterator>
 #include <limits>
-#include <sstream>
 #include <stdexcept>      // std::runtime_error
 #include <string>
 #include <string.h>
 #include <cstdlib>
+#include <cmath>
 #include <cerrno>
+#include <functional>     // std::hash
 #include <memory.h>
+#include <stdio.h>
 
 
 #include "../include/univalue.h"
@@ -23,6 +25,16 @@ using namespace std;
 
 const UniValue NullUniValue;
 
+// objects with less keys are searched linearly
+static const size_t KEY_INDEX_MIN_KEYS = 16;
+
+// open addressing (linear probing) over positions in keys, -1 marks a free
+// slot; the keys themselves are not copied
+struct UniValue::KeyIndex {
+    std::vector<int> slots;
+    size_t mask;
+};
+
 static bool ParsePrechecks(const std::string& str)
 {
     if (str.empty()) // No empty string allowed
@@ -78,12 +90,28 @@ bool ParseDouble(const std::string& str, double *out)
     return endp && *endp == 0 && !errno;
 }
 
+UniValue::UniValue(const UniValue& other)
+    : typ(other.typ), val(other.val), keys(other.keys), values(other.values),
+      keyIndex(std::atomic_load(&other.keyIndex)), numTag(other.numTag), num(other.num)
+{
+}
+
+UniValue& UniValue::operator=(const UniValue& other)
+{
+    // copy first, other may be an element of this
+    UniValue tmp(other);
+    *this = std::move(tmp);
+    return *this;
+}
+
 void UniValue::clear()
 {
     typ = VNULL;
+    numTag = NUM_NONE;
     val.clear();
     keys.clear();
     values.clear();
+    keyIndex.reset();
 }
 
 bool UniValue::setNull()
@@ -103,60 +131,220 @@ bool UniValue::setBool(bool val_)
 
 static bool validNumStr(const string& s)
 {
-    string tokenVal;
+    JsonTokenView token;
     unsigned int consumed;
-    enum jtokentype tt = getJsonToken(tokenVal, consumed, s.c_str());
-    return (tt == JTOK_NUMBER);
+    enum jtokentype tt = getJsonTokenView(token, consumed, s.data(),
+                                          s.data() + s.size());
+    return (tt == JTOK_NUMBER && consumed == s.size());
 }
 
-bool UniValue::setNumStr(const string& val_)
+// [-]digits without leading zeros, the magnitude has to fit 64 bits
+static bool parseJsonInteger(const char *p, const char *end,
+                             bool& negative, uint64_t& mag)
 {
-    if (!validNumStr(val_))
+    negative = (p < end && *p == '-');
+    if (negative)
+        p++;
+    if (p == end || (*p == '0' && end - p > 1))
         return false;
 
-    clear();
-    typ = VNUM;
-    val = val_;
+    mag = 0;
+    for (; p < end; p++) {
+        unsigned int digit = (unsigned char)*p - '0';
+        if (digit > 9)
+            return false;
+        if (mag > (std::numeric_limits<uint64_t>::max() - digit) / 10)
+            return false;
+        mag = mag * 10 + digit;
+    }
     return true;
 }
 
-bool UniValue::setInt(uint64_t val)
-{
-    string s;
-    ostringstream oss;
+// exact conversion of JSON numbers with up to 15 significant digits and a
+// small exponent: both the mantissa and the power of ten are exact doubles,
+// so a single rounding step gives the correctly rounded result (what strtod
+// returns); everything else is left to ParseDouble()
+static bool parseJsonDoubleFast(const char *p, const char *end, double& out)
+{
+    static const double pow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+
+    bool negative = (p < end && *p == '-');
+    if (negative)
+        p++;
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exp10 = 0;
+    bool any = false;
+    for (; p < end && isdigit(*p); p++, any = true) {
+        if (mantissa == 0 && *p == '0')
+            continue;
+        if (++digits > 15)
+            return false;
+        mantissa = mantissa * 10 + (*p - '0');
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && isdigit(*p); p++, any = true) {
+            exp10--;
+            if (mantissa == 0 && *p == '0')
+                continue;
+            if (++digits > 15)
+                return false;
+            mantissa = mantissa * 10 + (*p - '0');
+        }
+    }
+    if (!any)
+        return false;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool expNegative = (p < end && *p == '-');
+        if (p < end && (*p == '-' || *p == '+'))
+            p++;
+        if (p == end)
+            return false;
+        int e = 0;
+        for (; p < end && isdigit(*p); p++)
+            if (e < 1000)
+                e = e * 10 + (*p - '0');
+        exp10 += (expNegative ? -e : e);
+    }
+    if (p != end)
+        return false;
+
+    double d = (double)mantissa;
+    if (exp10 < -22 || exp10 > 22)
+        return (mantissa == 0) ? (out = (negative ? -0.0 : 0.0), true) : false;
+    d = (exp10 < 0) ? d / pow10[-exp10] : d * pow10[exp10];
+    out = negative ? -d : d;
+    return true;
+}
 
-    oss << val;
+void UniValue::setNumText(const string& text)
+{
+    const char *p = text.data();
+    const char *end = p + text.size();
+
+    bool negative;
+    uint64_t mag;
+    // "-0" takes the double path below, get_real() has to return -0.0
+    if (parseJsonInteger(p, end, negative, mag) && !(negative && mag == 0)) {
+        if (!negative && mag <= (uint64_t)std::numeric_limits<int64_t>::max()) {
+            numTag = NUM_INT64;
+            num.i64 = (int64_t)mag;
+        } else if (!negative) {
+            numTag = NUM_UINT64;
+            num.u64 = mag;
+        } else if (mag <= (uint64_t)std::numeric_limits<int64_t>::max() + 1) {
+            numTag = NUM_INT64;
+            num.i64 = (int64_t)(0 - mag);
+        } else {
+            numTag = NUM_DOUBLE;
+            num.dbl = -(double)mag;
+            val = text;
+        }
+        return;
+    }
 
-    return setNumStr(oss.str());
+    // fractions and exponents keep their text, the double would be written
+    // back differently
+    val = text;
+    if (parseJsonDoubleFast(p, end, num.dbl) || ParseDouble(text, &num.dbl))
+        numTag = NUM_DOUBLE;
+    else
+        numTag = NUM_TEXT;
 }
 
-bool UniValue::setInt(int64_t val)
+bool UniValue::setNumStr(const string& val_)
 {
-    string s;
-    ostringstream oss;
+    if (!validNumStr(val_))
+        return false;
 
-    oss << val;
+    clear();
+    typ = VNUM;
+    setNumText(val_);
+    return true;
+}
 
-    return setNumStr(oss.str());
+bool UniValue::setInt(uint64_t val_)
+{
+    clear();
+    typ = VNUM;
+    if (val_ <= (uint64_t)std::numeric_limits<int64_t>::max()) {
+        numTag = NUM_INT64;
+        num.i64 = (int64_t)val_;
+    } else {
+        numTag = NUM_UINT64;
+        num.u64 = val_;
+    }
+    return true;
 }
 
-bool UniValue::setFloat(double val)
+bool UniValue::setInt(int64_t val_)
 {
-    string s;
-    ostringstream oss;
+    clear();
+    typ = VNUM;
+    numTag = NUM_INT64;
+    num.i64 = val_;
+    return true;
+}
 
-    oss << std::setprecision(16) << val;
+bool UniValue::setFloat(double val_)
+{
+    if (std::isnan(val_) || std::isinf(val_))
+        return false;
 
-    bool ret = setNumStr(oss.str());
+    clear();
     typ = VREAL;
-    return ret;
+    numTag = NUM_DOUBLE;
+    num.dbl = val_;
+    return true;
+}
+
+// writes the decimal digits of v backwards, ending at end
+static char *formatUInt64(uint64_t v, char *end)
+{
+    do {
+        *--end = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    return end;
+}
+
+std::string UniValue::getNumStr() const
+{
+    if (!val.empty())
+        return val;
+
+    char buf[32];
+    char *end = buf + sizeof(buf);
+    char *first;
+    switch (numTag) {
+    case NUM_INT64:
+        if (num.i64 < 0) {
+            first = formatUInt64(0 - (uint64_t)num.i64, end);
+            *--first = '-';
+        } else
+            first = formatUInt64((uint64_t)num.i64, end);
+        return string(first, end);
+    case NUM_UINT64:
+        first = formatUInt64(num.u64, end);
+        return string(first, end);
+    case NUM_DOUBLE:
+        snprintf(buf, sizeof(buf), "%.16g", num.dbl);
+        return string(buf);
+    default:
+        return val;
+    }
 }
 
-bool UniValue::setStr(const string& val_)
+bool UniValue::setStr(string val_)
 {
     clear();
     typ = VSTR;
-    val = val_;
+    val = std::move(val_);
     return true;
 }
 
@@ -183,6 +371,15 @@ bool UniValue::push_back(const UniValue& val)
     return true;
 }
 
+bool UniValue::push_back(UniValue&& val)
+{
+    if (typ != VARR)
+        return false;
+
+    values.push_back(std::move(val));
+    return true;
+}
+
 bool UniValue::push_backV(const std::vector<UniValue>& vec)
 {
     if (typ != VARR)
@@ -193,6 +390,17 @@ bool UniValue::push_backV(const std::vector<UniValue>& vec)
     return true;
 }
 
+bool UniValue::push_backV(std::vector<UniValue>&& vec)
+{
+    if (typ != VARR)
+        return false;
+
+    values.insert(values.end(), std::make_move_iterator(vec.begin()), std::make_move_iterator(vec.end()));
+    vec.clear();
+
+    return true;
+}
+
 bool UniValue::pushKV(const std::string& key, const UniValue& val)
 {
     if (typ != VOBJ)
@@ -200,6 +408,18 @@ bool UniValue::pushKV(const std::string& key, const UniValue& val)
 
     keys.push_back(key);
     values.push_back(val);
+    keyIndex.reset();
+    return true;
+}
+
+bool UniValue::pushKV(std::string key, UniValue&& val)
+{
+    if (typ != VOBJ)
+        return false;
+
+    keys.push_back(std::move(key));
+    values.push_back(std::move(val));
+    keyIndex.reset();
     return true;
 }
 
@@ -212,18 +432,50 @@ bool UniValue::pushKVs(const UniValue& obj)
         keys.push_back(obj.keys[i]);
         values.push_back(obj.values[i]);
     }
+    keyIndex.reset();
 
     return true;
 }
 
 int UniValue::findKey(const std::string& key) const
 {
-    for (unsigned int i = 0; i < keys.size(); i++) {
-        if (keys[i] == key)
-            return (int) i;
+    if (keys.size() < KEY_INDEX_MIN_KEYS) {
+        for (unsigned int i = 0; i < keys.size(); i++) {
+            if (keys[i] == key)
+                return (int) i;
+        }
+        return -1;
+    }
+
+    // const objects may be shared between threads, concurrent first lookups
+    // build equal indexes and one of them is kept
+    std::shared_ptr<const KeyIndex> index = std::atomic_load(&keyIndex);
+    if (!index) {
+        std::shared_ptr<KeyIndex> newIndex = std::make_shared<KeyIndex>();
+        size_t nSlots = 1;
+        while (nSlots < keys.size() * 2)
+            nSlots <<= 1;
+        newIndex->slots.assign(nSlots, -1);
+        newIndex->mask = nSlots - 1;
+        for (unsigned int i = 0; i < keys.size(); i++) {
+            // duplicate keys: the first one is found, like in the linear search
+            size_t pos = std::hash<std::string>()(keys[i]) & newIndex->mask;
+            while (newIndex->slots[pos] >= 0 && keys[newIndex->slots[pos]] != keys[i])
+                pos = (pos + 1) & newIndex->mask;
+            if (newIndex->slots[pos] < 0)
+                newIndex->slots[pos] = i;
+        }
+        index = newIndex;
+        std::atomic_store(&keyIndex, index);
     }
 
-    return -1;
+    for (size_t pos = std::hash<std::string>()(key) & index->mask;; pos = (pos + 1) & index->mask) {
+        int i = index->slots[pos];
+        if (i < 0)
+            return -1;
+        if (keys[i] == key)
+            return i;
+    }
 }
 
 bool UniValue::checkObject(const std::map<std::string,UniValue::VType>& t)
@@ -281,31 +533,35 @@ const char *uvTypeName(UniValue::VType t)
 
 const UniValue& find_value( const UniValue& obj, const std::string& name)
 {
-    for (unsigned int i = 0; i < obj.keys.size(); i++)
-    {
-        if( obj.keys[i] == name )
-        {
-            return obj.values[i];
-        }
-    }
+    int index = obj.findKey(name);
+    if (index < 0)
+        return NullUniValue;
 
-    return NullUniValue;
+    return obj.values[index];
 }
 
-std::vector<std::string> UniValue::getKeys() const
+const std::vector<std::string>& UniValue::getKeys() const
 {
     if (typ != VOBJ)
         throw std::runtime_error("JSON value is not an object as expected");
     return keys;
 }
 
-std::vector<UniValue> UniValue::getValues() const
+const std::vector<UniValue>& UniValue::getValues() const
 {
     if (typ != VOBJ && typ != VARR)
         throw std::runtime_error("JSON value is not an object or array as expected");
     return values;
 }
 
+UniValue::KeyValueRange UniValue::getKeyValues() const
+{
+    if (typ != VOBJ)
+        throw std::runtime_error("JSON value is not an object as expected");
+    return KeyValueRange(const_kv_iterator(keys.data(), values.data()),
+                         const_kv_iterator(keys.data() + keys.size(), values.data() + values.size()));
+}
+
 bool UniValue::get_bool() const
 {
     if (typ != VBOOL)
@@ -324,30 +580,40 @@ int UniValue::get_int() const
 {
     if (typ != VNUM)
         throw std::runtime_error("JSON value is not an integer as expected");
-    int32_t retval;
-    if (!ParseInt32(getValStr(), &retval))
+    if (numTag != NUM_INT64) {
+        if (numTag == NUM_DOUBLE && val == "-0")
+            return 0;
+        throw std::runtime_error("JSON integer out of range");
+    }
+    if (num.i64 < std::numeric_limits<int32_t>::min() ||
+        num.i64 > std::numeric_limits<int32_t>::max())
         throw std::runtime_error("JSON integer out of range");
-    return retval;
+    return (int)num.i64;
 }
 
 int64_t UniValue::get_int64() const
 {
     if (typ != VNUM)
         throw std::runtime_error("JSON value is not an integer as expected");
-    int64_t retval;
-    if (!ParseInt64(getValStr(), &retval))
+    if (numTag != NUM_INT64) {
+        if (numTag == NUM_DOUBLE && val == "-0")
+            return 0;
         throw std::runtime_error("JSON integer out of range");
-    return retval;
+    }
+    return num.i64;
 }
 
 double UniValue::get_real() const
 {
     if (typ != VREAL && typ != VNUM)
         throw std::runtime_error("JSON value is not a number as expected");
-    double retval;
-    if (!ParseDouble(getValStr(), &retval))
+    switch (numTag) {
+    case NUM_INT64:  return (double)num.i64;
+    case NUM_UINT64: return (double)num.u64;
+    case NUM_DOUBLE: return num.dbl;
+    default:
         throw std::runtime_error("JSON double out of range");
-    return retval;
+    }
 }
 
 const UniValue& UniValue::get_obj() const
@@ -6,6 +6,9 @@
 #include <string.h>
 #include <vector>
 #include <stdio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "../include/univalue.h"
 
 using namespace std;
@@ -37,65 +40,118 @@ static const char *hatoui(const char *first, const char *last,
     return first;
 }
 
-enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
-                            const char *raw)
+static inline bool json_isspace(int ch)
+{
+    // same set as isspace() in the C locale
+    return ch == ' ' || (ch >= '\t' && ch <= '\r');
+}
+
+static inline bool json_isdigit(int ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+static inline bool json_isxdigit(int ch)
+{
+    return json_isdigit(ch) || (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F');
+}
+
+static const char *skipWhitespace(const char *p, const char *end)
+{
+    while (p < end && json_isspace(*p)) {
+        p++;
+#ifdef __SSE2__
+        // longer runs, the indentation of pretty printed documents
+        if (p < end && json_isspace(*p)) {
+            while (end - p >= 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *)p);
+                __m128i ws = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                 _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+                    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+                                 _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))));
+                unsigned int other = ~_mm_movemask_epi8(ws) & 0xffff;
+                if (other) {
+                    p += __builtin_ctz(other);
+                    break;
+                }
+                p += 16;
+            }
+        }
+#endif
+    }
+    return p;
+}
+
+// first '"', '\\' or control character in [p, end)
+static const char *scanStringChars(const char *p, const char *end)
+{
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i ctrlMax = _mm_set1_epi8(0x1f);
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+            _mm_cmpeq_epi8(_mm_min_epu8(v, ctrlMax), v));
+        unsigned int mask = _mm_movemask_epi8(special);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20)
+        p++;
+    return p;
+}
+
+enum jtokentype getJsonTokenView(JsonTokenView& token, unsigned int& consumed,
+                                 const char *raw, const char *end)
 {
-    tokenVal.clear();
+    token.data = NULL;
+    token.len = 0;
+    token.escaped = false;
     consumed = 0;
 
     const char *rawStart = raw;
 
-    while ((*raw) && (isspace(*raw)))             // skip whitespace
-        raw++;
+    raw = skipWhitespace(raw, end);
+    if (raw == end)
+        return JTOK_NONE;
 
+    enum jtokentype tok;
     switch (*raw) {
 
     case 0:
         return JTOK_NONE;
 
-    case '{':
-        raw++;
-        consumed = (raw - rawStart);
-        return JTOK_OBJ_OPEN;
-    case '}':
-        raw++;
-        consumed = (raw - rawStart);
-        return JTOK_OBJ_CLOSE;
-    case '[':
-        raw++;
-        consumed = (raw - rawStart);
-        return JTOK_ARR_OPEN;
-    case ']':
-        raw++;
-        consumed = (raw - rawStart);
-        return JTOK_ARR_CLOSE;
-
-    case ':':
-        raw++;
-        consumed = (raw - rawStart);
-        return JTOK_COLON;
-    case ',':
-        raw++;
-        consumed = (raw - rawStart);
-        return JTOK_COMMA;
+    case '{': tok = JTOK_OBJ_OPEN; break;
+    case '}': tok = JTOK_OBJ_CLOSE; break;
+    case '[': tok = JTOK_ARR_OPEN; break;
+    case ']': tok = JTOK_ARR_CLOSE; break;
+    case ':': tok = JTOK_COLON; break;
+    case ',': tok = JTOK_COMMA; break;
 
     case 'n':
     case 't':
-    case 'f':
-        if (!strncmp(raw, "null", 4)) {
+    case 'f': {
+        size_t left = end - raw;
+        if (left >= 4 && !memcmp(raw, "null", 4)) {
             raw += 4;
             consumed = (raw - rawStart);
             return JTOK_KW_NULL;
-        } else if (!strncmp(raw, "true", 4)) {
+        } else if (left >= 4 && !memcmp(raw, "true", 4)) {
             raw += 4;
             consumed = (raw - rawStart);
             return JTOK_KW_TRUE;
-        } else if (!strncmp(raw, "false", 5)) {
+        } else if (left >= 5 && !memcmp(raw, "false", 5)) {
             raw += 5;
             consumed = (raw - rawStart);
             return JTOK_KW_FALSE;
         } else
             return JTOK_ERR;
+        }
 
     case '-':
     case '0':
@@ -109,125 +165,87 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
     case '8':
     case '9': {
         // part 1: int
-        string numStr;
-
         const char *first = raw;
 
-        const char *firstDigit = first;
-        if (!isdigit(*firstDigit))
-            firstDigit++;
-        if ((*firstDigit == '0') && isdigit(firstDigit[1]))
-            return JTOK_ERR;
-
-        numStr += *raw;                       // copy first char
-        raw++;
-
-        if ((*first == '-') && (!isdigit(*raw)))
+        if (*raw == '-') {
+            raw++;
+            if (raw == end || !json_isdigit(*raw))
+                return JTOK_ERR;
+        }
+        if ((*raw == '0') && (raw + 1 < end) && json_isdigit(raw[1]))
             return JTOK_ERR;
 
-        while ((*raw) && isdigit(*raw)) {     // copy digits
-            numStr += *raw;
+        while (raw < end && json_isdigit(*raw))
             raw++;
-        }
 
         // part 2: frac
-        if (*raw == '.') {
-            numStr += *raw;                   // copy .
+        if (raw < end && *raw == '.') {
             raw++;
-
-            if (!isdigit(*raw))
+            if (raw == end || !json_isdigit(*raw))
                 return JTOK_ERR;
-            while ((*raw) && isdigit(*raw)) { // copy digits
-                numStr += *raw;
+            while (raw < end && json_isdigit(*raw))
                 raw++;
-            }
         }
 
         // part 3: exp
-        if (*raw == 'e' || *raw == 'E') {
-            numStr += *raw;                   // copy E
+        if (raw < end && (*raw == 'e' || *raw == 'E')) {
             raw++;
-
-            if (*raw == '-' || *raw == '+') { // copy +/-
-                numStr += *raw;
+            if (raw < end && (*raw == '-' || *raw == '+'))
                 raw++;
-            }
-
-            if (!isdigit(*raw))
+            if (raw == end || !json_isdigit(*raw))
                 return JTOK_ERR;
-            while ((*raw) && isdigit(*raw)) { // copy digits
-                numStr += *raw;
+            while (raw < end && json_isdigit(*raw))
                 raw++;
-            }
         }
 
-        tokenVal = numStr;
+        token.data = first;
+        token.len = raw - first;
         consumed = (raw - rawStart);
         return JTOK_NUMBER;
         }
 
     case '"': {
         raw++;                                // skip "
+        const char *first = raw;
 
-        string valStr;
+        while (1) {
+            raw = scanStringChars(raw, end);
+            if (raw == end || (unsigned char)*raw < 0x20)
+                return JTOK_ERR;              // unterminated or control char
+            if (*raw == '"')
+                break;
 
-        while (*raw) {
-            if (*raw < 0x20)
+            // validate the escape, decoding is left to unescapeJsonString()
+            token.escaped = true;
+            raw++;                            // skip backslash
+            if (raw == end)
                 return JTOK_ERR;
-
-            else if (*raw == '\\') {
-                raw++;                        // skip backslash
-
-                switch (*raw) {
-                case '"':  valStr += "\""; break;
-                case '\\': valStr += "\\"; break;
-                case '/':  valStr += "/"; break;
-                case 'b':  valStr += "\b"; break;
-                case 'f':  valStr += "\f"; break;
-                case 'n':  valStr += "\n"; break;
-                case 'r':  valStr += "\r"; break;
-                case 't':  valStr += "\t"; break;
-
-                case 'u': {
-                    unsigned int codepoint;
-                    if (hatoui(raw + 1, raw + 1 + 4, codepoint) !=
-                               raw + 1 + 4)
-                        return JTOK_ERR;
-
-                    if (codepoint <= 0x7f)
-                        valStr.push_back((char)codepoint);
-                    else if (codepoint <= 0x7FF) {
-                        valStr.push_back((char)(0xC0 | (codepoint >> 6)));
-                        valStr.push_back((char)(0x80 | (codepoint & 0x3F)));
-                    } else if (codepoint <= 0xFFFF) {
-                        valStr.push_back((char)(0xE0 | (codepoint >> 12)));
-                        valStr.push_back((char)(0x80 | ((codepoint >> 6) & 0x3F)));
-                        valStr.push_back((char)(0x80 | (codepoint & 0x3F)));
-                    }
-
-                    raw += 4;
-                    break;
-                    }
-                default:
-                    return JTOK_ERR;
-
-                }
-
-                raw++;                        // skip esc'd char
-            }
-
-            else if (*raw == '"') {
-                raw++;                        // skip "
-                break;                        // stop scanning
-            }
-
-            else {
-                valStr += *raw;
+            switch (*raw) {
+            case '"':
+            case '\\':
+            case '/':
+            case 'b':
+            case 'f':
+            case 'n':
+            case 'r':
+            case 't':
                 raw++;
+                break;
+            case 'u':
+                if (end - raw < 5 || !json_isxdigit(raw[1]) ||
+                    !json_isxdigit(raw[2]) || !json_isxdigit(raw[3]) ||
+                    !json_isxdigit(raw[4]))
+                    return JTOK_ERR;
+                raw += 5;
+                break;
+            default:
+                return JTOK_ERR;
             }
         }
 
-        tokenVal = valStr;
+        token.data = first;
+        token.len = raw - first;
+        raw++;                                // skip "
         consumed = (raw - rawStart);
         return JTOK_STRING;
         }
@@ -235,143 +253,200 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
     default:
         return JTOK_ERR;
     }
+
+    // single character tokens
+    consumed = (raw + 1 - rawStart);
+    return tok;
 }
 
-bool UniValue::read(const char *raw)
+void unescapeJsonString(const char *s, size_t len, string& out)
 {
-    clear();
+    out.clear();
+    const char *end = s + len;
 
-    bool expectName = false;
-    bool expectColon = false;
-    vector<UniValue*> stack;
+    while (s < end) {
+        const char *esc = (const char *)memchr(s, '\\', end - s);
+        if (!esc) {
+            out.append(s, end - s);
+            break;
+        }
+        out.append(s, esc - s);
+        s = esc + 1;                          // skip backslash
+
+        switch (*s) {
+        case 'b':  out += '\b'; break;
+        case 'f':  out += '\f'; break;
+        case 'n':  out += '\n'; break;
+        case 'r':  out += '\r'; break;
+        case 't':  out += '\t'; break;
+
+        case 'u': {
+            unsigned int codepoint;
+            hatoui(s + 1, s + 1 + 4, codepoint);
+
+            if (codepoint <= 0x7f)
+                out.push_back((char)codepoint);
+            else if (codepoint <= 0x7FF) {
+                out.push_back((char)(0xC0 | (codepoint >> 6)));
+                out.push_back((char)(0x80 | (codepoint & 0x3F)));
+            } else if (codepoint <= 0xFFFF) {
+                out.push_back((char)(0xE0 | (codepoint >> 12)));
+                out.push_back((char)(0x80 | ((codepoint >> 6) & 0x3F)));
+                out.push_back((char)(0x80 | (codepoint & 0x3F)));
+            }
 
-    enum jtokentype tok = JTOK_NONE;
-    enum jtokentype last_tok = JTOK_NONE;
-    while (1) {
-        last_tok = tok;
+            s += 4;
+            break;
+            }
 
-        string tokenVal;
+        default:   out += *s; break;          // '"', '\\' and '/'
+        }
+
+        s++;                                  // skip esc'd char
+    }
+}
+
+// the value of a string or number token as a string
+static void getTokenValue(enum jtokentype tok, const JsonTokenView& token,
+                          string& tokenVal)
+{
+    if (tok == JTOK_STRING && token.escaped)
+        unescapeJsonString(token.data, token.len, tokenVal);
+    else if (tok == JTOK_STRING || tok == JTOK_NUMBER)
+        tokenVal.assign(token.data, token.len);
+    else
+        tokenVal.clear();
+}
+
+enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
+                            const char *raw)
+{
+    JsonTokenView token;
+    enum jtokentype tok = getJsonTokenView(token, consumed, raw,
+                                           raw + strlen(raw));
+    getTokenValue(tok, token, tokenVal);
+    return tok;
+}
+
+// what readJsonEvents() accepts as the next token
+enum jexpect {
+    EXP_ROOT,           // the opening of the top-level object or array
+    EXP_FIRST_NAME,     // a member name or '}' right after '{'
+    EXP_NAME,           // a member name after ','
+    EXP_COLON,
+    EXP_VALUE,          // a value after ':' or after ',' in an array
+    EXP_FIRST_VALUE,    // a value or ']' right after '['
+    EXP_NEXT,           // ',' or the close of the current container
+};
+
+bool readJsonEvents(const char *raw, size_t len, UniValueEventHandler& handler)
+{
+    const char *end = raw + len;
+    enum jexpect expect = EXP_ROOT;
+
+    // '{' or '[' for every open container, stays in the inline buffer of the
+    // string for the nesting depths seen in practice
+    string stack;
+
+    // the tokens refer to the input, strings and numbers get copied here for
+    // the events, reusing the buffer
+    JsonTokenView token;
+    string tokenVal;
+
+    while (1) {
         unsigned int consumed;
-        tok = getJsonToken(tokenVal, consumed, raw);
+        enum jtokentype tok = getJsonTokenView(token, consumed, raw, end);
         if (tok == JTOK_NONE || tok == JTOK_ERR)
-            break;
+            return false;
         raw += consumed;
 
         switch (tok) {
 
         case JTOK_OBJ_OPEN:
         case JTOK_ARR_OPEN: {
-            VType utyp = (tok == JTOK_OBJ_OPEN ? VOBJ : VARR);
-            if (!stack.size()) {
-                if (utyp == VOBJ)
-                    setObject();
-                else
-                    setArray();
-                stack.push_back(this);
-            } else {
-                UniValue tmpVal(utyp);
-                UniValue *top = stack.back();
-                top->values.push_back(tmpVal);
+            if (expect != EXP_ROOT && expect != EXP_VALUE &&
+                expect != EXP_FIRST_VALUE)
+                return false;
 
-                UniValue *newTop = &(top->values.back());
-                stack.push_back(newTop);
+            if (tok == JTOK_OBJ_OPEN) {
+                stack.push_back('{');
+                expect = EXP_FIRST_NAME;
+                if (!handler.startObject())
+                    return false;
+            } else {
+                stack.push_back('[');
+                expect = EXP_FIRST_VALUE;
+                if (!handler.startArray())
+                    return false;
             }
-
-            if (utyp == VOBJ)
-                expectName = true;
             break;
             }
 
         case JTOK_OBJ_CLOSE:
         case JTOK_ARR_CLOSE: {
-            if (!stack.size() || expectColon || (last_tok == JTOK_COMMA))
+            bool isObj = (tok == JTOK_OBJ_CLOSE);
+            if (stack.empty() || stack.back() != (isObj ? '{' : '['))
                 return false;
-
-            VType utyp = (tok == JTOK_OBJ_CLOSE ? VOBJ : VARR);
-            UniValue *top = stack.back();
-            if (utyp != top->getType())
+            if (expect != EXP_NEXT &&
+                expect != (isObj ? EXP_FIRST_NAME : EXP_FIRST_VALUE))
                 return false;
 
             stack.pop_back();
-            expectName = false;
-            break;
-            }
-
-        case JTOK_COLON: {
-            if (!stack.size() || expectName || !expectColon)
+            expect = EXP_NEXT;
+            if (!(isObj ? handler.endObject() : handler.endArray()))
                 return false;
 
-            UniValue *top = stack.back();
-            if (top->getType() != VOBJ)
-                return false;
-
-            expectColon = false;
+            // only whitespace may follow the top-level value (up to the
+            // end or a NUL byte)
+            if (stack.empty())
+                return (getJsonTokenView(token, consumed, raw, end) == JTOK_NONE);
             break;
             }
 
-        case JTOK_COMMA: {
-            if (!stack.size() || expectName || expectColon ||
-                (last_tok == JTOK_COMMA) || (last_tok == JTOK_ARR_OPEN))
+        case JTOK_COLON:
+            if (expect != EXP_COLON)
                 return false;
-
-            UniValue *top = stack.back();
-            if (top->getType() == VOBJ)
-                expectName = true;
+            expect = EXP_VALUE;
             break;
-            }
 
-        case JTOK_KW_NULL:
-        case JTOK_KW_TRUE:
-        case JTOK_KW_FALSE: {
-            if (!stack.size() || expectName || expectColon)
+        case JTOK_COMMA:
+            if (expect != EXP_NEXT)
                 return false;
+            expect = (stack.back() == '{' ? EXP_NAME : EXP_VALUE);
+            break;
 
-            UniValue tmpVal;
-            switch (tok) {
-            case JTOK_KW_NULL:
-                // do nothing more
-                break;
-            case JTOK_KW_TRUE:
-                tmpVal.setBool(true);
+        case JTOK_STRING:
+            getTokenValue(tok, token, tokenVal);
+            if (expect == EXP_FIRST_NAME || expect == EXP_NAME) {
+                expect = EXP_COLON;
+                if (!handler.key(tokenVal))
+                    return false;
                 break;
-            case JTOK_KW_FALSE:
-                tmpVal.setBool(false);
-                break;
-            default: /* impossible */ break;
-            }
-
-            UniValue *top = stack.back();
-            top->values.push_back(tmpVal);
-
-            break;
             }
+            // a string value
+            // fall through
 
+        case JTOK_KW_NULL:
+        case JTOK_KW_TRUE:
+        case JTOK_KW_FALSE:
         case JTOK_NUMBER: {
-            if (!stack.size() || expectName || expectColon)
+            if (expect != EXP_VALUE && expect != EXP_FIRST_VALUE)
                 return false;
+            expect = EXP_NEXT;
 
-            UniValue tmpVal(VNUM, tokenVal);
-            UniValue *top = stack.back();
-            top->values.push_back(tmpVal);
+            if (tok == JTOK_NUMBER)
+                getTokenValue(tok, token, tokenVal);
 
-            break;
+            bool ok;
+            switch (tok) {
+            case JTOK_STRING:   ok = handler.str(tokenVal); break;
+            case JTOK_NUMBER:   ok = handler.num(tokenVal); break;
+            case JTOK_KW_TRUE:  ok = handler.boolean(true); break;
+            case JTOK_KW_FALSE: ok = handler.boolean(false); break;
+            default:            ok = handler.null(); break;
             }
-
-        case JTOK_STRING: {
-            if (!stack.size())
+            if (!ok)
                 return false;
-
-            UniValue *top = stack.back();
-
-            if (expectName) {
-                top->keys.push_back(tokenVal);
-                expectName = false;
-                expectColon = true;
-            } else {
-                UniValue tmpVal(VSTR, tokenVal);
-                top->values.push_back(tmpVal);
-            }
-
             break;
             }
 
@@ -379,10 +454,64 @@ bool UniValue::read(const char *raw)
             return false;
         }
     }
+}
 
-    if (stack.size() != 0)
+UniValue *UniValueBuilder::append(UniValue::VType type, const string& val)
+{
+    if (stack.empty())
+        return NULL;
+
+    UniValue *top = stack.back();
+    if (top->typ == UniValue::VOBJ)
+        top->keys.push_back(std::move(pendingKey));
+    top->values.emplace_back();
+
+    UniValue *value = &top->values.back();
+    value->typ = type;
+    if (type == UniValue::VNUM)
+        value->setNumText(val);             // the text only if needed
+    else
+        value->val = val;
+    return value;
+}
+
+bool UniValueBuilder::open(UniValue::VType type)
+{
+    if (stack.empty()) {
+        if (closed)
+            return false;
+        root.clear();
+        root.typ = type;
+        stack.push_back(&root);
+        return true;
+    }
+
+    UniValue *newTop = append(type, "");
+    stack.push_back(newTop);
+    return true;
+}
+
+bool UniValueBuilder::close()
+{
+    if (stack.empty())
         return false;
 
+    stack.pop_back();
+    if (stack.empty())
+        closed = true;
     return true;
 }
 
+bool readJsonEvents(const char *raw, UniValueEventHandler& handler)
+{
+    return readJsonEvents(raw, strlen(raw), handler);
+}
+
+bool UniValue::read(const char *raw, size_t len)
+{
+    clear();
+
+    UniValueBuilder builder(*this);
+    return readJsonEvents(raw, len, builder) && builder.complete();
+}
+
@@ -4,8 +4,6 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <ctype.h>
-#include <iomanip>
-#include <sstream>
 #include <stdio.h>
 #include "../include/univalue.h"
 #include "univalue_escapes.h"
@@ -64,13 +62,21 @@ string UniValue::write(unsigned int prettyIndent,
         break;
     case VREAL:
         {
-            std::stringstream ss;
-            ss << std::showpoint << std::fixed << std::setprecision(8) << get_real();
-            s += ss.str();
+            char buf[64];
+            double d = get_real();
+            int len = snprintf(buf, sizeof(buf), "%.8f", d);
+            if (len > 0 && (size_t)len < sizeof(buf))
+                s.append(buf, len);
+            else if (len > 0) {                 // beyond 1e55
+                size_t pos = s.size();
+                s.resize(pos + len + 1);
+                snprintf(&s[pos], len + 1, "%.8f", d);
+                s.resize(pos + len);
+            }
         }
         break;
     case VNUM:
-        s += val;
+        s += getNumStr();
         break;
     case VBOOL:
         s += (val == "1" ? "true" : "false");